@@ -0,0 +1,555 @@
+/* bench.cpp
+ * Written by:  Keefer Rourke
+ * License:     GPLv3
+ *
+ * COPYRIGHT    Keefer Rourke 2015
+ *
+ * Description: This program will time the stages of the huffpuff
+ *              compressor and decompressor on synthetic input so that
+ *              changes to them can be measured.
+ *
+ * Disclaimer:  This program is free software: you can redistribute it
+ *              and/or modify it under the terms of the GNU General
+ *              Public License as published by the Free Software
+ *              Foundation, either version 3 of the License, or (at
+ *              your option) any later version.
+ *
+ *              This program is distributed in the hope that it will
+ *              be useful, but WITHOUT ANY WARRANTY; without even the
+ *              implied warranty of MERCHANTABILITY or FITNESS FOR A
+ *              PARTICULAR PURPOSE.  See the GNU General Public License
+ *              for more details.
+ *
+ *              You should have received a copy of the GNU General
+ *              Public License along with this program.  If not, see
+ *              <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include "../lib/hufftree.hpp"
+#include "../lib/huff.hpp"
+#include "../lib/puff.hpp"
+
+using namespace std;
+
+/* the stages that are timed, in the order that they run; the last two are
+ * baselines: decoding by walking the tree one bit at a time, which the lookup
+ * table is measured against, and copying the input, which gives an upper
+ * bound for a single pass over it */
+const int NSTAGES = 9;
+const char * STAGES[NSTAGES] = { "getContents", "getCFreqs", "createHuffTree",
+    "genHuffCodes", "encodeText", "writeToFile", "decode", "decodeNaive", "memcpy" };
+
+// the kinds of input that can be generated
+const int NCORPORA = 5;
+const char * CORPORA[NCORPORA] = { "english", "logs", "random", "single", "all256" };
+
+/* every corpus is run over and over until at least this many bytes have gone
+ * through, so that the small sizes are timed over many runs */
+const size_t MIN_BENCH_BYTES = 16 << 20;
+
+/* structure used to hold the timings of one corpus at one size */
+struct benchresult
+{
+    string corpus;
+    size_t size;
+    int    runs;
+    double secs[NSTAGES];          // total over every run
+    unsigned long long sizeofBin;  // size of the binary file
+};
+
+bool   benchCorpus(string &contents, size_t blockSize, int nstreams, benchresult &result);
+bool   benchBaselines(string &contents, size_t blockSize, benchresult &result);
+string decodeNaive(vector <unsigned char> &contents, size_t count, hufftree &huffTree);
+string makeCorpus(string name, size_t size);
+string makeEnglish(size_t size);
+string makeLogs(size_t size);
+string makeRandom(size_t size);
+string makeAll256(size_t size);
+unsigned long long nextRandom(unsigned long long &state);
+string tempName(string tag);
+bool   parseSize(const char * arg, size_t &size);
+double seconds();
+void   printResult(benchresult &result);
+void   printJson(vector <benchresult> &results, size_t blockSize, int nstreams);
+void   printUse();
+
+int main(int argc, char * argv[])
+{
+    // by default every corpus is run at a few sizes
+    vector <string> corpora(CORPORA, CORPORA + NCORPORA);
+    size_t defaultSizes[] = { 1 << 10, 64 << 10, 1 << 20, 16 << 20 };
+    vector <size_t> sizes(defaultSizes, defaultSizes + 4);
+    size_t blockSize = DEFAULT_BLOCK_SIZE;
+    int  nstreams = 1;
+    bool json = false;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--json")
+            json = true;
+        else if (arg == "--corpus" && hasValue)
+        {
+            // a comma separated list of corpora
+            corpora.clear();
+            string list = argv[++i];
+            size_t start = 0;
+            while (start <= list.size())
+            {
+                size_t comma = min(list.find(',', start), list.size());
+                corpora.push_back(list.substr(start, comma - start));
+                start = comma + 1;
+            }
+        }
+        else if (arg == "--sizes" && hasValue)
+        {
+            // a comma separated list of sizes, such as 1K,1M,1G
+            sizes.clear();
+            char * list = argv[++i];
+            for (char * size = strtok(list, ","); size != NULL; size = strtok(NULL, ","))
+            {
+                size_t n;
+                if (!parseSize(size, n) || n == 0)
+                {
+                    cerr << "Error. '" << size << "' is not a size." << endl;
+                    return 1;
+                }
+                sizes.push_back(n);
+            }
+        }
+        else if ((arg == "-b" || arg == "--block-size") && hasValue)
+        {
+            if (!parseSize(argv[++i], blockSize) || blockSize == 0 || blockSize > MAX_BLOCK_SIZE)
+            {
+                cerr << "Error. The block size must be from 1 byte to "
+                     << (MAX_BLOCK_SIZE >> 20) << "M." << endl;
+                return 1;
+            }
+        }
+        else if (arg == "--streams" && hasValue)
+        {
+            nstreams = atoi(argv[++i]);
+            if (nstreams < 1 || nstreams > MAX_STREAMS || (nstreams & (nstreams - 1)))
+            {
+                cerr << "Error. The number of streams must be 1, 2, 4 or 8." << endl;
+                return 1;
+            }
+        }
+        else
+        {
+            printUse();
+            return 1;
+        }
+    }
+
+    vector <benchresult> results;
+    for (size_t c = 0; c < corpora.size(); c++)
+    {
+        for (size_t s = 0; s < sizes.size(); s++)
+        {
+            string contents = makeCorpus(corpora[c], sizes[s]);
+            if (contents.empty())
+            {
+                cerr << "Error. There is no corpus called '" << corpora[c] << "'." << endl;
+                return 1;
+            }
+            benchresult result;
+            result.corpus = corpora[c];
+            if (!benchCorpus(contents, blockSize, nstreams, result))
+                return 1;
+            if (!json)
+                printResult(result);
+            results.push_back(result);
+        }
+    }
+    if (json)
+        printJson(results, blockSize, nstreams);
+    return 0;
+}
+
+/* this function will compress the contents block by block the way huffCompress
+ * does, and then decompress them the way huffExtract does, timing each stage;
+ * the input and the binary file go through real files, so that reading and
+ * writing them is timed as well, and the decoded blocks are checked against
+ * the input, returning false if they do not match */
+bool benchCorpus(string &contents, size_t blockSize, int nstreams, benchresult &result)
+{
+    result.size = contents.size();
+    result.runs = max((size_t)1, MIN_BENCH_BYTES / contents.size());
+    for (int i = 0; i < NSTAGES; i++)
+        result.secs[i] = 0;
+
+    string infilename  = tempName("txt");
+    string binfilename = tempName("bin");
+    ofstream corpus(infilename.c_str(), ios::binary | ios::trunc);
+    corpus.write(contents.data(), contents.size());
+    corpus.close();
+
+    const unsigned char * text = (const unsigned char *)contents.data();
+    bitwriter header, encodedText;
+    blockscratch scratch;
+    decodejob job;
+    bool matches = true;
+    for (int run = 0; run < result.runs && matches; run++)
+    {
+        // read the input file, touching every page of it as compressing would
+        inputfile infile;
+        openInput(infilename, infile);
+        double start = seconds();
+        const unsigned char * block;
+        size_t n;
+        volatile unsigned char touched;
+        while (getContents(infile, blockSize, block, n))
+        {
+            for (size_t i = 0; i < n; i += 4096)
+                touched = block[i];
+            releaseContents(infile, block + n);
+        }
+        result.secs[0] += seconds() - start;
+        closeInput(infile);
+        (void)touched;
+
+        // compress each block, one stage at a time
+        ofstream outfile(binfilename.c_str(), ios::binary | ios::trunc);
+        outfile.write(HUFF_MAGIC, sizeof(HUFF_MAGIC));
+        vector <blockindex> index;
+        unsigned long long offset = sizeof(HUFF_MAGIC);
+        for (size_t pos = 0; pos < contents.size(); pos += n)
+        {
+            n = min(blockSize, contents.size() - pos);
+            double t0 = seconds();
+            vector <cfreq> &cfreqs = scratch.cfreqs;
+            getCFreqs(text + pos, n, cfreqs);
+            sort(cfreqs.begin(), cfreqs.end(), compareByFreq);
+            double t1 = seconds();
+            hufftree &huffTree = scratch.tree;
+            makeForest(cfreqs, huffTree);
+            createHuffTree(huffTree);
+            double t2 = seconds();
+            vector <huffcode> &codes = scratch.codes;
+            codes.clear();
+            genHuffCodes(huffTree, huffTree.root, 0, 0, codes);
+            limitCodeLengths(cfreqs, codes, DEFAULT_MAX_CODE_LEN);
+            canonicalCodes(codes);
+            double t3 = seconds();
+            vector <uint> &streamSizes = scratch.streamSizes;
+            initWriter(encodedText, n);
+            encodeStreams(text + pos, n, codes, nstreams, encodedText, streamSizes,
+                          scratch.stream);
+            initWriter(header);
+            putBits(header, HUFFMAN_BLOCK, 8);
+            writeCodeLengths(codes, header);
+            writeStreamTable(streamSizes, header);
+            double t4 = seconds();
+            writeToFile(outfile, n, header, encodedText);
+            double t5 = seconds();
+            result.secs[1] += t1 - t0;
+            result.secs[2] += t2 - t1;
+            result.secs[3] += t3 - t2;
+            result.secs[4] += t4 - t3;
+            result.secs[5] += t5 - t4;
+
+            blockindex entry;
+            entry.offset = offset;
+            entry.sizeofBlock = n;
+            entry.sizeofText = header.bytes.size() + encodedText.bytes.size();
+            index.push_back(entry);
+            offset += 2 * sizeof(uint) + entry.sizeofText;
+        }
+        writeTrailer(outfile, index, contents.size());
+        result.sizeofBin = outfile.tellp();
+        outfile.close();
+
+        // read the blocks back, timing only the decoding of each
+        ifstream binfile(binfilename.c_str(), ios::binary);
+        binfile.ignore(sizeof(HUFF_MAGIC));
+        size_t pos = 0;
+        while (matches && getBinContents(binfile, job.sizeofBlock, job.binContents)
+               && job.sizeofBlock > 0)
+        {
+            double start = seconds();
+            decodeJob(&job, false);
+            result.secs[6] += seconds() - start;
+            matches = job.decoded && pos + job.sizeofBlock <= contents.size()
+                      && memcmp(&job.decodedText[0], text + pos, job.sizeofBlock) == 0;
+            pos += job.sizeofBlock;
+        }
+        matches = matches && pos == contents.size() && benchBaselines(contents, blockSize, result);
+    }
+
+    remove(infilename.c_str());
+    remove(binfilename.c_str());
+    if (!matches)
+        cerr << "Error. Decoded " << result.corpus << " does not match the input." << endl;
+    return matches;
+}
+
+/* this function will time the baselines for one run over the contents: each
+ * block is copied, and then encoded as a single stream and decoded by walking
+ * the tree, returning false if the decoded block does not match the input */
+bool benchBaselines(string &contents, size_t blockSize, benchresult &result)
+{
+    const unsigned char * text = (const unsigned char *)contents.data();
+    vector <unsigned char> copy(blockSize);
+    bitwriter encodedText;
+    hufftree huffTree;
+    size_t n;
+    for (size_t pos = 0; pos < contents.size(); pos += n)
+    {
+        n = min(blockSize, contents.size() - pos);
+        double start = seconds();
+        memcpy(&copy[0], text + pos, n);
+        result.secs[8] += seconds() - start;
+
+        vector <cfreq> cfreqs;
+        getCFreqs(text + pos, n, cfreqs);
+        sort(cfreqs.begin(), cfreqs.end(), compareByFreq);
+        makeForest(cfreqs, huffTree);
+        createHuffTree(huffTree);
+        vector <huffcode> codes;
+        genHuffCodes(huffTree, huffTree.root, 0, 0, codes);
+        limitCodeLengths(cfreqs, codes, DEFAULT_MAX_CODE_LEN);
+        canonicalCodes(codes);
+        initWriter(encodedText, n);
+        encodeText(text + pos, n, codes, encodedText);
+        alignBits(encodedText);
+        rebuildHuffTree(codes, huffTree);
+
+        start = seconds();
+        string decodedText = decodeNaive(encodedText.bytes, n, huffTree);
+        result.secs[7] += seconds() - start;
+        if (memcmp(decodedText.data(), text + pos, n) != 0 || memcmp(&copy[0], text + pos, n) != 0)
+            return false;
+    }
+    return true;
+}
+
+/* this function will decode the encoded text one bit at a time by walking the
+ * Huffman tree, which is what the lookup table is measured against */
+string decodeNaive(vector <unsigned char> &contents, size_t count, hufftree &huffTree)
+{
+    string decodedText = "";
+    int n = huffTree.root;
+    for (size_t i = 0; decodedText.size() < count; i++)
+    {
+        bool bit = (contents[i / 8] >> (7 - i % 8)) & 1;
+        n = bit ? huffTree.nodes[n].right : huffTree.nodes[n].left;
+        if (huffTree.nodes[n].isLeaf)
+        {
+            decodedText.push_back(huffTree.nodes[n].c);
+            n = huffTree.root;
+        }
+    }
+    return decodedText;
+}
+
+/* this function will generate size bytes of the named corpus, returning an
+ * empty string if there is no such corpus */
+string makeCorpus(string name, size_t size)
+{
+    if (name == "english")
+        return makeEnglish(size);
+    if (name == "logs")
+        return makeLogs(size);
+    if (name == "random")
+        return makeRandom(size);
+    if (name == "single")
+        return string(size, 'a');
+    if (name == "all256")
+        return makeAll256(size);
+    return "";
+}
+
+/* this function will generate text made of common English words, with
+ * punctuation and line breaks */
+string makeEnglish(size_t size)
+{
+    const char * words[] = { "the", "of", "and", "to", "in", "a", "is", "that",
+        "for", "it", "as", "was", "with", "be", "by", "on", "not", "he", "this",
+        "are", "or", "his", "from", "at", "which", "but", "have", "an", "had",
+        "they", "you", "were", "their", "one", "all", "we", "can", "her", "has",
+        "there", "been", "if", "more", "when", "will", "would", "who", "so",
+        "no", "Huffman", "tree", "code", "error", "request", "2015", "42" };
+    const int nwords = sizeof(words) / sizeof(words[0]);
+
+    string text;
+    text.reserve(size + 16);
+    srand(12);
+    while (text.size() < size)
+    {
+        // favour the words at the front of the list
+        int r = rand() % nwords;
+        text += words[rand() % (r + 1)];
+        int p = rand() % 16;
+        if (p == 0)
+            text += ".\n";
+        else if (p == 1)
+            text += ", ";
+        else
+            text += ' ';
+    }
+    text.resize(size);
+    return text;
+}
+
+/* this function will generate the lines of a server log, most of which are
+ * the same few messages at the same level, so that a handful of characters
+ * make up most of the text */
+string makeLogs(size_t size)
+{
+    const char * messages[] = { "request served", "cache hit", "cache miss",
+        "connection opened", "connection closed", "slow query", "retrying" };
+    const int nmessages = sizeof(messages) / sizeof(messages[0]);
+
+    string text;
+    text.reserve(size + 128);
+    unsigned long long state = 42;
+    unsigned long long clock = 1433160000;
+    char line[128];
+    while (text.size() < size)
+    {
+        unsigned long long r = nextRandom(state);
+        clock += r % 3;
+        int level = r % 100;
+        const char * name = level < 90 ? "INFO " : level < 98 ? "WARN " : "ERROR";
+        // the first messages are far more common than the rest
+        int m = (r >> 8) % nmessages;
+        m = (r >> 16) % (m + 1);
+        snprintf(line, sizeof(line), "%llu %s %s id=%llu in %llu ms\n", clock, name,
+                 messages[m], (r >> 24) % 100000, (r >> 48) % 50);
+        text += line;
+    }
+    text.resize(size);
+    return text;
+}
+
+/* this function will generate bytes with every value equally likely, which
+ * Huffman coding can not compress */
+string makeRandom(size_t size)
+{
+    string text(size, '\0');
+    unsigned long long state = 7;
+    for (size_t i = 0; i < size; i++)
+        text[i] = (char)(nextRandom(state) >> 56);
+    return text;
+}
+
+/* this function will generate bytes of every value, each the smaller of two
+ * random bytes, so the low values are common and the high ones are rare and
+ * get long codes */
+string makeAll256(size_t size)
+{
+    string text(size, '\0');
+    unsigned long long state = 99;
+    for (size_t i = 0; i < size; i++)
+    {
+        unsigned long long r = nextRandom(state);
+        text[i] = (char)min(r >> 56, (r >> 48) & 0xff);
+    }
+    return text;
+}
+
+/* this function will return the next number of a xorshift generator, which is
+ * much quicker than rand() and the same on every system */
+unsigned long long nextRandom(unsigned long long &state)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ull;
+}
+
+/* this function will name a scratch file in the temporary directory */
+string tempName(string tag)
+{
+    const char * dir = getenv("TMPDIR");
+    string name = dir ? dir : "/tmp";
+    long long stamp = chrono::steady_clock::now().time_since_epoch().count();
+    return name + "/huffbench-" + to_string(stamp) + "." + tag;
+}
+
+/* this function will read a size such as 4096, 64K, 16M or 1G, returning
+ * false if it is not one */
+bool parseSize(const char * arg, size_t &size)
+{
+    char * end;
+    size = strtoull(arg, &end, 10);
+    if (end == arg || *arg == '-')
+        return false;
+    if (*end == 'k' || *end == 'K')
+        size <<= 10, end++;
+    else if (*end == 'm' || *end == 'M')
+        size <<= 20, end++;
+    else if (*end == 'g' || *end == 'G')
+        size <<= 30, end++;
+    return *end == '\0';
+}
+
+/* this function will return the wall clock time in seconds */
+double seconds()
+{
+    return chrono::duration <double> (chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* this function will print the throughput of every stage for one corpus */
+void printResult(benchresult &result)
+{
+    double bytes = (double)result.size * result.runs;
+    cout << result.corpus << ", " << result.size << " bytes, " << result.runs
+         << (result.runs == 1 ? " run" : " runs") << ", ratio "
+         << fixed << setprecision(4) << (double)result.sizeofBin / result.size << endl;
+    for (int i = 0; i < NSTAGES; i++)
+    {
+        cout << "  " << left << setw(16) << STAGES[i] << right
+             << setprecision(1) << setw(10) << bytes / result.secs[i] / 1e6 << " MB/s"
+             << setprecision(3) << setw(10) << result.secs[i] * 1e9 / bytes << " ns/byte"
+             << endl;
+    }
+    cout << endl;
+}
+
+/* this function will print every result as a JSON array, so that runs can be
+ * compared by a script */
+void printJson(vector <benchresult> &results, size_t blockSize, int nstreams)
+{
+    cout << "[" << endl;
+    for (size_t r = 0; r < results.size(); r++)
+    {
+        benchresult &result = results[r];
+        double bytes = (double)result.size * result.runs;
+        cout << "  {\"corpus\": \"" << result.corpus << "\", \"size\": " << result.size
+             << ", \"block_size\": " << blockSize << ", \"streams\": " << nstreams
+             << ", \"runs\": " << result.runs << ", \"ratio\": " << setprecision(6)
+             << (double)result.sizeofBin / result.size << "," << endl;
+        cout << "   \"stages\": {";
+        for (int i = 0; i < NSTAGES; i++)
+        {
+            cout << (i ? "," : "") << endl << "     \"" << STAGES[i] << "\": {\"seconds\": "
+                 << result.secs[i] << ", \"mb_per_s\": " << bytes / result.secs[i] / 1e6
+                 << ", \"ns_per_byte\": " << result.secs[i] * 1e9 / bytes << "}";
+        }
+        cout << "}}" << (r + 1 < results.size() ? "," : "") << endl;
+    }
+    cout << "]" << endl;
+}
+
+/* this function will print how to run the benchmark */
+void printUse()
+{
+    cout << "usage: bench [--corpus NAME,...] [--sizes SIZE,...] [-b SIZE]" << endl;
+    cout << "             [--streams N] [--json]\n" << endl;
+    cout << "   --corpus   english, logs, random, single and/or all256 (default all)" << endl;
+    cout << "   --sizes    sizes of input such as 1K,64K,1M,1G (default 1K,64K,1M,16M)" << endl;
+    cout << "   -b         block size to compress in (default 1M)" << endl;
+    cout << "   --streams  streams to split each block into, 1, 2, 4 or 8 (default 1)" << endl;
+    cout << "   --json     print the results as JSON" << endl;
+}
@@ -34,64 +34,344 @@
 #include <vector>
 #include <string>
 #include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <new>
 #include "lib/hufftree.hpp"
 #include "lib/huff.hpp"
 #include "lib/puff.hpp"
+#include "lib/dict.hpp"
+#include "lib/batch.hpp"
 
 using namespace std;
 
 bool isEmpty(string file);
+bool parseSize(const char * arg, unsigned long long &size);
+bool parseRange(const char * arg, unsigned long long &start, unsigned long long &len);
 void printUse();
 
+/* allocations are counted for the --stats report once it has been asked for,
+ * so that without it new costs nothing more than malloc; these are kept out
+ * of line, or gcc sees through them and warns that new is paired with free */
+static bool countAllocations = false;
+
+#ifdef __GNUC__
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+NOINLINE void * operator new(size_t size)
+{
+    if (countAllocations)
+        allocations().fetch_add(1, memory_order_relaxed);
+    void * p = malloc(size ? size : 1);
+    if (p == NULL)
+        throw bad_alloc();
+    return p;
+}
+
+NOINLINE void operator delete(void * p) noexcept
+{
+    free(p);
+}
+
+NOINLINE void operator delete(void * p, size_t) noexcept
+{
+    free(p);
+}
+
 int main(int argc, char * argv[])
 {
+    // the first argument says what to do, the rest are options and file names
+    vector <string> files;
+    // options left at 0 are chosen by the compression level
+    int level = 0;
+    int maxCodeLen = 0;
+    size_t blockSize = DEFAULT_BLOCK_SIZE;
+    int nthreads = 1;
+    int nstreams = 1;
+    unsigned long long rangeStart = 0, rangeLen = ULLONG_MAX;
+    bool wantStats = false, statsJson = false;
+    bool adaptive = false;
+    bool contexts = false;
+    bool split = false;
+    bool batchMode = false;
+    int lzLevel = 0;
+    size_t window = 0;
+    size_t rebuildInterval = 0;
+    string dictfilename;
+    string listfilename;
+    for (int i = 2; i < argc; i++)
+    {
+        if (((strcmp(argv[i], "-b")) == 0 || (strcmp(argv[i], "--block-size")) == 0) && i + 1 < argc)
+        {
+            unsigned long long size;
+            if (!parseSize(argv[++i], size) || size == 0 || size > MAX_BLOCK_SIZE)
+            {
+                cerr << "Error. The block size must be from 1 byte to "
+                     << (MAX_BLOCK_SIZE >> 20) << "M." << endl;
+                return 0;
+            }
+            blockSize = size;
+            continue;
+        }
+        if ((strcmp(argv[i], "--range")) == 0 && i + 1 < argc)
+        {
+            if (!parseRange(argv[++i], rangeStart, rangeLen))
+            {
+                cerr << "Error. A range is given as start:length, such as 64M:4M." << endl;
+                return 0;
+            }
+            continue;
+        }
+        if (((strcmp(argv[i], "-j")) == 0 || (strcmp(argv[i], "--threads")) == 0) && i + 1 < argc)
+        {
+            nthreads = atoi(argv[++i]);
+            if (nthreads < 1 || nthreads > MAX_THREADS)
+            {
+                cerr << "Error. The number of threads must be from 1 to "
+                     << MAX_THREADS << "." << endl;
+                return 0;
+            }
+            continue;
+        }
+        if ((strcmp(argv[i], "--streams")) == 0 && i + 1 < argc)
+        {
+            nstreams = atoi(argv[++i]);
+            if (nstreams < 1 || nstreams > MAX_STREAMS || (nstreams & (nstreams - 1)))
+            {
+                cerr << "Error. The number of streams must be 1, 2, 4 or 8." << endl;
+                return 0;
+            }
+            continue;
+        }
+        if ((strcmp(argv[i], "--lz")) == 0 && i + 1 < argc)
+        {
+            lzLevel = atoi(argv[++i]);
+            if (lzLevel < 1 || lzLevel > MAX_LZ_LEVEL)
+            {
+                cerr << "Error. The LZ level must be from 1 to " << MAX_LZ_LEVEL << "." << endl;
+                return 0;
+            }
+            continue;
+        }
+        if ((strcmp(argv[i], "--window")) == 0 && i + 1 < argc)
+        {
+            unsigned long long size;
+            if (!parseSize(argv[++i], size) || size < MIN_WINDOW || size > MAX_BLOCK_SIZE)
+            {
+                cerr << "Error. The window must be from " << MIN_WINDOW << " bytes to "
+                     << (MAX_BLOCK_SIZE >> 20) << "M." << endl;
+                return 0;
+            }
+            window = size;
+            continue;
+        }
+        if ((strcmp(argv[i], "--context")) == 0)
+        {
+            contexts = true;
+            continue;
+        }
+        if ((strcmp(argv[i], "--split")) == 0)
+        {
+            split = true;
+            continue;
+        }
+        if (argv[i][0] == '-' && argv[i][1] >= '1' && argv[i][1] <= '0' + MAX_LEVEL
+            && argv[i][2] == '\0')
+        {
+            level = argv[i][1] - '0';
+            continue;
+        }
+        if ((strcmp(argv[i], "-a")) == 0 || (strcmp(argv[i], "--adaptive")) == 0)
+        {
+            adaptive = true;
+            continue;
+        }
+        if ((strcmp(argv[i], "--rebuild")) == 0 && i + 1 < argc)
+        {
+            unsigned long long size;
+            if (!parseSize(argv[++i], size) || size < MIN_REBUILD_INTERVAL
+                || size > MAX_REBUILD_INTERVAL)
+            {
+                cerr << "Error. The rebuild interval must be from "
+                     << (MIN_REBUILD_INTERVAL >> 10) << "K to "
+                     << (MAX_REBUILD_INTERVAL >> 20) << "M." << endl;
+                return 0;
+            }
+            adaptive = true;
+            rebuildInterval = size;
+            continue;
+        }
+        if ((strcmp(argv[i], "--batch")) == 0)
+        {
+            batchMode = true;
+            continue;
+        }
+        if ((strcmp(argv[i], "--from-list")) == 0 && i + 1 < argc)
+        {
+            listfilename = argv[++i];
+            continue;
+        }
+        if ((strcmp(argv[i], "--dict")) == 0 && i + 1 < argc)
+        {
+            dictfilename = argv[++i];
+            continue;
+        }
+        if ((strcmp(argv[i], "--stats")) == 0 || (strcmp(argv[i], "--stats=json")) == 0)
+        {
+            wantStats = true;
+            statsJson = argv[i][7] == '=';
+            countAllocations = true;
+            continue;
+        }
+        if ((strcmp(argv[i], "--max-code-len")) == 0 && i + 1 < argc)
+        {
+            maxCodeLen = atoi(argv[++i]);
+            if (maxCodeLen < 8 || maxCodeLen > MAX_CODE_LEN)
+            {
+                cerr << "Error. The maximum code length must be from 8 to "
+                     << MAX_CODE_LEN << " bits." << endl;
+                return 0;
+            }
+        }
+        else
+            files.push_back(argv[i]);
+    }
+
+    /* the report is only collected when asked for, and goes to stderr so it
+     * never mixes with the files written */
+    huffstats statsReport;
+    huffstats * stats = NULL;
+    double start = wallSeconds();
+    /* the level chooses the options, and any given as well change what it
+     * chooses, whichever order they come in */
+    huffoptions opts;
+    initLevel(opts, level ? level : DEFAULT_LEVEL, nstreams);
+    if (maxCodeLen)
+        opts.maxCodeLen = maxCodeLen;
+    maxCodeLen = opts.maxCodeLen;
+    if (lzLevel)
+        opts.lzLevel = lzLevel;
+    if (window)
+    {
+        opts.window = window;
+        if (opts.lzLevel == 0)
+            opts.lzLevel = DEFAULT_LZ_LEVEL;
+    }
+    opts.contexts = opts.contexts || contexts;
+    opts.split = opts.split || split;
+
+    /* a dictionary used to compress or extract is loaded first, building its
+     * tables once */
+    huffdict dict;
+    if (!dictfilename.empty() && !loadDict(dictfilename, dict))
+    {
+        cerr << "Error. '" << dictfilename << "' is not a valid dictionary file." << endl;
+        return 0;
+    }
+
     // check that the number of arguments is valid, if not then print usage instructions and exit
-    if (argc < 3 || argc > 4)
+    /* with --batch, or a list of them, the files are compressed as a batch,
+     * each to a file of its own; without it two names are always the input
+     * and the output, however many a wildcard happened to match */
+    bool train = argc > 1 && (strcmp(argv[1], "--train")) == 0;
+    bool compress = argc > 1 && ((strcmp(argv[1], "-c")) == 0 || (strcmp(argv[1], "--compress")) == 0);
+    bool inBatch = compress && (batchMode || !listfilename.empty());
+    if (argc < 3 || (files.size() < 1 && listfilename.empty())
+        || (files.size() > 2 && !train && !inBatch))
     {
         cout << "Error. Invalid number of arguments." << endl;
         printUse();
         return 0;
     }
-    // argv[2] is the input file name, and argv[3] is the output file name
+    // if user wants to train a dictionary, files[0] is its name and the rest are samples
+    else if (train)
+    {
+        if (files.size() < 2)
+        {
+            cerr << "Error. A dictionary is trained on at least one sample file." << endl;
+            return 0;
+        }
+        vector <string> samples(files.begin() + 1, files.end());
+        huffTrain(samples, files[0], maxCodeLen);
+    }
+    // if user gives many files to compress, compress them all in this one process
+    else if (inBatch)
+    {
+        if (!listfilename.empty() && !readList(listfilename, files))
+        {
+            cerr << "Error. Could not read the list of files '" << listfilename << "'." << endl;
+            return 0;
+        }
+        if (adaptive)
+        {
+            cerr << "Error. The adaptive mode compresses one file at a time." << endl;
+            return 0;
+        }
+        if (wantStats)
+        {
+            initStats(statsReport, COMPRESS_STAGES, NCOMPRESS_STAGES);
+            stats = &statsReport;
+        }
+        huffCompressBatch(files, opts, blockSize, nthreads, dictfilename.empty() ? NULL : &dict,
+                          stats);
+    }
+    // files[0] is the input file name, and files[1] is the output file name
     // if user specifies that they want to extract a file, extract the file
-    // the function huffExtract(string, string) is in huff.hpp
+    // the function huffExtract(string, string, int, unsigned long long, unsigned long long, huffstats *) is in puff.hpp
     else if ((strcmp(argv[1], "-x")) == 0 || (strcmp(argv[1], "--extract")) == 0 || (strcmp(argv[1], "--decompress")) == 0 || (strcmp(argv[1], "--inflate")) == 0)
        {
-           string infilename = argv[2];
-           // check if specified infile is empty, quit if true
-           if (isEmpty(infilename))
+           string infilename = files[0];
+           /* check if specified infile is empty, quit if true; standard input is
+            * not checked, as peeking at a pipe would use up what it holds */
+           if (infilename != "-" && isEmpty(infilename))
            {
                cerr << "Error: " << infilename << " is an empty file." << endl;
                return 0;
            }
+           if (wantStats)
+           {
+               initStats(statsReport, EXTRACT_STAGES, NEXTRACT_STAGES);
+               stats = &statsReport;
+           }
 
-           if (argc > 3)
+           if (!dictfilename.empty())
+               huffExtractDict(infilename, files.size() > 1 ? files[1] : "out.txt", dict);
+           else if (files.size() > 1)
            {
-               string outfilename = argv[3];
-               huffExtract(infilename, outfilename);
+               string outfilename = files[1];
+               huffExtract(infilename, outfilename, nthreads, rangeStart, rangeLen, stats);
            }
            else
-               huffExtract(infilename);
+               huffExtract(infilename, "out.txt", nthreads, rangeStart, rangeLen, stats);
        }
     // if user specifies that they want to compress a file, compress the file
-    // the function huffCompress(string, string) is in puff.hpp
+    // the function huffCompress(string, string, huffoptions &, size_t, int, huffstats *) is in huff.hpp
     else if ((strcmp(argv[1], "-c")) == 0 || (strcmp(argv[1], "--compress")) == 0)
     {
-        string infilename = argv[2];
-        // check if specified infile is empty, quit if true
-        if (isEmpty(infilename))
+        // an empty file is fine, it compresses to a file with no blocks
+        string infilename = files[0];
+        if (wantStats)
         {
-            cerr << "Error: " << infilename << " is an empty file." << endl;
-            return 0;
+            initStats(statsReport, COMPRESS_STAGES, NCOMPRESS_STAGES);
+            stats = &statsReport;
         }
-
-        if (argc > 3)
+        /* a message compressed with a dictionary has no codes of its own, and
+         * the adaptive mode codes the input in one pass, without blocks */
+        if (!dictfilename.empty())
+            huffCompressDict(infilename, files.size() > 1 ? files[1] : "out.bin", dict);
+        else if (adaptive)
+            huffCompressAdaptive(infilename, files.size() > 1 ? files[1] : "out.bin",
+                                 maxCodeLen, rebuildInterval, stats);
+        else if (files.size() > 1)
         {
-            string outfilename = argv[3];
-            huffCompress(infilename, outfilename);
+            string outfilename = files[1];
+            huffCompress(infilename, outfilename, opts, blockSize, nthreads, stats);
         }
         else
-            huffCompress(infilename);
+            huffCompress(infilename, "out.bin", opts, blockSize, nthreads, stats);
     }
     // if user specifies bad arguments, print usage
     else
@@ -99,6 +379,8 @@ int main(int argc, char * argv[])
         cerr << "Error. Bad arguments." << endl;
         printUse();
     }
+    if (stats)
+        printStats(cerr, *stats, wallSeconds() - start, statsJson);
 
     return 0;
 }
@@ -110,6 +392,34 @@ bool isEmpty(string file)
     return infile.peek() == ifstream::traits_type::eof();
 }
 
+/* this function will read a size such as 4096, 64K or 16M, returning false if
+ * it is not one */
+bool parseSize(const char * arg, unsigned long long &size)
+{
+    char * end;
+    size = strtoull(arg, &end, 10);
+    if (end == arg || *arg == '-')
+        return false;
+    if (*end == 'k' || *end == 'K')
+        size <<= 10, end++;
+    else if (*end == 'm' || *end == 'M')
+        size <<= 20, end++;
+    else if (*end == 'g' || *end == 'G')
+        size <<= 30, end++;
+    return *end == '\0';
+}
+
+/* this function will read a range of characters given as start:length, where
+ * both are sizes that parseSize understands */
+bool parseRange(const char * arg, unsigned long long &start, unsigned long long &len)
+{
+    const char * colon = strchr(arg, ':');
+    if (colon == NULL)
+        return false;
+    string first(arg, colon - arg);
+    return parseSize(first.c_str(), start) && parseSize(colon + 1, len);
+}
+
 /* this function simply prints the manual for the huffpuff program
  * in the case that a user makes a syntax error while using the utility */
 void printUse()
@@ -119,8 +429,10 @@ void printUse()
     cout << "SYNOPSIS" << endl;
     cout << "   huffpuff [-c] [--compress] [-x] [--extract] [--decompress]" << endl;
     cout << "   [--inflate] file ...\n" << endl;
+    cout << "   huffpuff -c --batch [--from-list list] file ...\n" << endl;
+    cout << "   huffpuff --train dictionary sample ...\n" << endl;
     cout << "DESCRIPTION" << endl;
-    cout << "   Compress plain-text files, and decompress Huffman binary files" << endl;
+    cout << "   Compress files of any kind, and decompress Huffman binary files" << endl;
     cout << "   created by this programme.\n" << endl;
     cout << "OPTIONS" << endl;
     cout << "   Mandatory arguments are as follows, plus the input file name.\n" << endl;
@@ -128,10 +440,88 @@ void printUse()
     cout << "       compress a plain-text file to a smaller binary file\n" << endl;
     cout << "   -x, --extract, --decompress, --inflate" << endl;
     cout << "       decompress a binary file back to plain-text\n" << endl;
-    cout << "   Optionally an output file name can be specified (see usage)\n " << endl;
+    cout << "   --train" << endl;
+    cout << "       train a dictionary of codes on the sample files, for compressing" << endl;
+    cout << "       small messages like them with --dict\n" << endl;
+    cout << "   Optionally an output file name can be specified (see usage); a file" << endl;
+    cout << "   name of - reads standard input or writes standard output.\n" << endl;
+    cout << "   --batch" << endl;
+    cout << "       when compressing, compress every file named to a file of the same" << endl;
+    cout << "       name with .bin added, all in this one process\n" << endl;
+    cout << "   --from-list FILE" << endl;
+    cout << "       when compressing, also compress every file named in FILE, one to a" << endl;
+    cout << "       line, or on standard input if FILE is -, as a batch\n" << endl;
+    cout << "   -b, --block-size SIZE" << endl;
+    cout << "       when compressing, give every SIZE characters (default 1M) codes of" << endl;
+    cout << "       their own; memory use depends on SIZE and not the size of the file\n" << endl;
+    cout << "   -j, --threads N" << endl;
+    cout << "       compress or decode N blocks at once on N threads (default 1), or N" << endl;
+    cout << "       files of a batch; the binary file is the same whatever the number" << endl;
+    cout << "       of threads\n" << endl;
+    cout << "   --range START:LENGTH" << endl;
+    cout << "       when extracting, write only LENGTH characters from START on, such" << endl;
+    cout << "       as 64M:4M, decoding just the blocks that hold them\n" << endl;
+    cout << "   --streams N" << endl;
+    cout << "       when compressing, split each block into N streams, 1, 2, 4 or 8" << endl;
+    cout << "       (default 1), which are decoded side by side for speed\n" << endl;
+    cout << "   -1 ... -9" << endl;
+    cout << "       when compressing, trade speed for size: -1 builds codes from a" << endl;
+    cout << "       sample of each block and repeats them wherever it can, -2 (the" << endl;
+    cout << "       default) counts every character, -3 to -6 add --lz at rising" << endl;
+    cout << "       levels, and -7 to -9 add --context and --split as well; the options" << endl;
+    cout << "       below change what a level chooses, and every level is extracted" << endl;
+    cout << "       the same way\n" << endl;
+    cout << "   --lz LEVEL" << endl;
+    cout << "       when compressing, code repeated strings as matches against earlier" << endl;
+    cout << "       ones in the block, from level 1, fastest, to 9, which looks hardest" << endl;
+    cout << "       for long matches; a block only uses them when they save bits\n" << endl;
+    cout << "   --window SIZE" << endl;
+    cout << "       with --lz, match strings at most SIZE characters back (default 1M)," << endl;
+    cout << "       at level " << DEFAULT_LZ_LEVEL << " unless --lz is given\n" << endl;
+    cout << "   --context" << endl;
+    cout << "       when compressing, code each character with one of up to 16 tables," << endl;
+    cout << "       chosen by the character before it, in blocks where that takes fewer" << endl;
+    cout << "       bits than a single table; logs often shrink by a third or more\n" << endl;
+    cout << "   --split" << endl;
+    cout << "       when compressing, end blocks where the characters change, such as" << endl;
+    cout << "       around a base64 attachment in a log, rather than every block size;" << endl;
+    cout << "       slower, but no block is longer than the block size\n" << endl;
+    cout << "   -a, --adaptive" << endl;
+    cout << "       when compressing, code the input in a single pass with codes that" << endl;
+    cout << "       change after every character, writing each piece of it out as soon" << endl;
+    cout << "       as it is read, for pipes and sockets that cannot be read twice\n" << endl;
+    cout << "   --rebuild SIZE" << endl;
+    cout << "       code the input adaptively, rebuilding the codes from the characters" << endl;
+    cout << "       seen so far every SIZE characters, such as 64K, which is much faster" << endl;
+    cout << "       than changing them after every character\n" << endl;
+    cout << "   --dict FILE" << endl;
+    cout << "       compress the file as a single message with the codes of a trained" << endl;
+    cout << "       dictionary, which it refers to by ID instead of holding codes of its" << endl;
+    cout << "       own, or extract a message compressed that way\n" << endl;
+    cout << "   --stats, --stats=json" << endl;
+    cout << "       report the time spent in each stage, the bytes read and written," << endl;
+    cout << "       the code lengths and entropy, peak memory and allocations on" << endl;
+    cout << "       stderr, as text or as JSON\n" << endl;
+    cout << "   --max-code-len N" << endl;
+    cout << "       when compressing, make no code longer than N bits, from 8 to 15" << endl;
+    cout << "       (default 11); shorter codes decode faster but compress less\n" << endl;
     cout << "USAGE EXAMPLES" << endl;
     cout << "   huffpuff -c inputfile.txt" << endl;
     cout << "   huffpuff -x inputfile.bin" << endl;
     cout << "   huffpuff --compress inputfile.txt outputfile.bin" << endl;
-    cout << "   huffpuff --inflate inputfile.bin outputfile.txt\n" << endl;
+    cout << "   huffpuff -c --max-code-len 15 inputfile.txt outputfile.bin" << endl;
+    cout << "   huffpuff -c -b 256K inputfile.txt outputfile.bin" << endl;
+    cout << "   huffpuff -c -j 4 inputfile.txt outputfile.bin" << endl;
+    cout << "   huffpuff -c --streams 4 inputfile.txt outputfile.bin" << endl;
+    cout << "   huffpuff -c --context -j 4 server.log server.bin" << endl;
+    cout << "   huffpuff -c --lz 9 --window 256K server.log server.bin" << endl;
+    cout << "   huffpuff -c --stats=json inputfile.txt outputfile.bin" << endl;
+    cout << "   tail -f events.log | huffpuff -c --rebuild 64K - events.bin" << endl;
+    cout << "   huffpuff --train messages.dict samples/*.json" << endl;
+    cout << "   huffpuff -c --dict messages.dict message.json message.bin" << endl;
+    cout << "   huffpuff -c --batch -j 4 logs/*.log" << endl;
+    cout << "   find logs -name '*.log' | huffpuff -c -j 4 --from-list -" << endl;
+    cout << "   huffpuff --inflate inputfile.bin outputfile.txt" << endl;
+    cout << "   huffpuff -x --range 1G:16M archive.bin part.txt" << endl;
+    cout << "   tar -c dir | huffpuff -c -j 4 - - > dir.tar.bin\n" << endl;
 }
@@ -0,0 +1,180 @@
+/* adaptive.hpp
+ * Written by:  Keefer Rourke
+ * License:     GPLv3
+ *
+ * COPYRIGHT    Keefer Rourke 2015
+ *
+ * Description: This header file contains a set of functions required
+ *              for the adaptive Huffman tree of the FGK algorithm, which
+ *              is updated as each character is coded so that the text
+ *              can be coded in a single pass, by the compressor and the
+ *              extractor alike
+ *
+ * Disclaimer:  This program is free software: you can redistribute it
+ *              and/or modify it under the terms of the GNU General
+ *              Public License as published by the Free Software
+ *              Foundation, either version 3 of the License, or (at
+ *              your option) any later version.
+ *
+ *              This program is distributed in the hope that it will
+ *              be useful, but WITHOUT ANY WARRANTY; without even the
+ *              implied warranty of MERCHANTABILITY or FITNESS FOR A
+ *              PARTICULAR PURPOSE.  See the GNU General Public License
+ *              for more details.
+ *
+ *              You should have received a copy of the GNU General
+ *              Public License along with this program.  If not, see
+ *              <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __ADAPTIVE_HPP__
+#define __ADAPTIVE_HPP__
+
+#include <algorithm>
+
+using namespace std;
+
+/* the tree holds a leaf for every character seen so far and one more for
+ * characters not yet seen, so it never has more than this many nodes; the
+ * root is always the last of them */
+const int MAX_ADAPTIVE_NODES = 2 * 257 - 1;
+const int ADAPTIVE_ROOT      = MAX_ADAPTIVE_NODES - 1;
+// character of the leaf standing for every character not yet seen
+const short NOT_YET_SEEN = 256;
+// character of a node that is not a leaf, and index of a missing node
+const short NO_CHAR = -1;
+const short NO_ADAPTIVE_NODE = -1;
+
+/* node structure for the adaptive tree; a node's index is its number in the
+ * sibling property, so that weights never decrease from one index to the
+ * next and siblings are next to each other */
+struct adaptivenode
+{
+    unsigned long long weight; // times the characters below it have occurred
+    short parent;
+    short left;
+    short right;
+    short c;                   // the character of a leaf
+};
+
+/* structure used to hold the adaptive tree, with the leaf of each character
+ * so that its code can be found by walking up from it */
+struct adaptivetree
+{
+    adaptivenode nodes[MAX_ADAPTIVE_NODES];
+    short leaf[256];           // NO_ADAPTIVE_NODE for characters not yet seen
+    int   notYetSeen;          // leaf standing for the characters not yet seen
+    int   next;                // highest index not yet in use
+};
+
+/* prototypes for adaptive tree functions */
+void   initAdaptiveTree(adaptivetree &tree);
+int    adaptivePath(adaptivetree &tree, int n, unsigned char path[MAX_ADAPTIVE_NODES]);
+void   updateAdaptiveTree(adaptivetree &tree, unsigned char c);
+void   swapSubtrees(adaptivetree &tree, int a, int b);
+void   adoptNode(adaptivetree &tree, int n);
+
+/* this function will empty the tree, leaving only the leaf for characters
+ * not yet seen, which is also the root */
+inline void initAdaptiveTree(adaptivetree &tree)
+{
+    for (int c = 0; c < 256; c++)
+        tree.leaf[c] = NO_ADAPTIVE_NODE;
+    adaptivenode &root = tree.nodes[ADAPTIVE_ROOT];
+    root.weight = 0;
+    root.parent = NO_ADAPTIVE_NODE;
+    root.left   = NO_ADAPTIVE_NODE;
+    root.right  = NO_ADAPTIVE_NODE;
+    root.c      = NOT_YET_SEEN;
+    tree.notYetSeen = ADAPTIVE_ROOT;
+    tree.next = ADAPTIVE_ROOT - 1;
+}
+
+/* this function will find the code of node n by walking up from it to the
+ * root, storing the bits of the code last bit first in path (1 for a right
+ * child), and returning its length */
+inline int adaptivePath(adaptivetree &tree, int n, unsigned char path[MAX_ADAPTIVE_NODES])
+{
+    int len = 0;
+    while (n != ADAPTIVE_ROOT)
+    {
+        int parent = tree.nodes[n].parent;
+        path[len++] = tree.nodes[parent].right == n;
+        n = parent;
+    }
+    return len;
+}
+
+/* this function will count one more occurrence of c, the way both the coder
+ * and the decoder do after each character; a character not seen before
+ * splits the leaf for such characters into a leaf of its own and a new one
+ * for the rest. Then, from its leaf up to the root, each node is swapped with
+ * the highest numbered node of the same weight before its weight goes up, so
+ * that the weights stay in order and the tree stays a Huffman tree */
+inline void updateAdaptiveTree(adaptivetree &tree, unsigned char c)
+{
+    int q = tree.leaf[c];
+    if (q == NO_ADAPTIVE_NODE)
+    {
+        int p = tree.notYetSeen;
+        adaptivenode &leaf = tree.nodes[tree.next];
+        adaptivenode &rest = tree.nodes[tree.next - 1];
+        leaf.weight = rest.weight = 0;
+        leaf.parent = rest.parent = p;
+        leaf.left = leaf.right = rest.left = rest.right = NO_ADAPTIVE_NODE;
+        leaf.c = c;
+        rest.c = NOT_YET_SEEN;
+        tree.nodes[p].right = tree.next;
+        tree.nodes[p].left  = tree.next - 1;
+        tree.nodes[p].c     = NO_CHAR;
+        tree.leaf[c] = tree.next;
+        tree.notYetSeen = tree.next - 1;
+        tree.next -= 2;
+        q = tree.leaf[c];
+    }
+
+    while (q != NO_ADAPTIVE_NODE)
+    {
+        // the highest numbered node of the same weight, which is never below q
+        int b = q;
+        while (b < ADAPTIVE_ROOT && tree.nodes[b + 1].weight == tree.nodes[q].weight)
+            b++;
+        // a node cannot be swapped with its own parent
+        if (b != q && b != tree.nodes[q].parent)
+        {
+            swapSubtrees(tree, q, b);
+            q = b;
+        }
+        tree.nodes[q].weight++;
+        q = tree.nodes[q].parent;
+    }
+}
+
+/* this function will swap the subtrees at a and b, each index keeping its
+ * place under its parent */
+inline void swapSubtrees(adaptivetree &tree, int a, int b)
+{
+    swap(tree.nodes[a], tree.nodes[b]);
+    swap(tree.nodes[a].parent, tree.nodes[b].parent);
+    adoptNode(tree, a);
+    adoptNode(tree, b);
+}
+
+/* this function will point whatever refers to the contents of node n, its
+ * children or the leaf of its character, back at n after it has moved */
+inline void adoptNode(adaptivetree &tree, int n)
+{
+    adaptivenode &moved = tree.nodes[n];
+    if (moved.c == NO_CHAR)
+    {
+        tree.nodes[moved.left].parent  = n;
+        tree.nodes[moved.right].parent = n;
+    }
+    else if (moved.c == NOT_YET_SEEN)
+        tree.notYetSeen = n;
+    else
+        tree.leaf[moved.c] = n;
+}
+
+#endif
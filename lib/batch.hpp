@@ -0,0 +1,257 @@
+/* batch.hpp
+ * Written by:  Keefer Rourke
+ * License:     GPLv3
+ *
+ * COPYRIGHT    Keefer Rourke 2015
+ *
+ * Description: This header file contains a set of functions required
+ *              for compressing many files in one run, shared out among
+ *              worker threads that each keep their buffers and tables
+ *              from one file to the next
+ *
+ * Disclaimer:  This program is free software: you can redistribute it
+ *              and/or modify it under the terms of the GNU General
+ *              Public License as published by the Free Software
+ *              Foundation, either version 3 of the License, or (at
+ *              your option) any later version.
+ *
+ *              This program is distributed in the hope that it will
+ *              be useful, but WITHOUT ANY WARRANTY; without even the
+ *              implied warranty of MERCHANTABILITY or FITNESS FOR A
+ *              PARTICULAR PURPOSE.  See the GNU General Public License
+ *              for more details.
+ *
+ *              You should have received a copy of the GNU General
+ *              Public License along with this program.  If not, see
+ *              <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __BATCH_HPP__
+#define __BATCH_HPP__
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <atomic>
+#include <mutex>
+#include "huff.hpp"
+#include "codec.hpp"
+#include "dict.hpp"
+#include "threadpool.hpp"
+#include "stats.hpp"
+
+using namespace std;
+
+/* a file of a batch is compressed in memory, in one piece, unless it is
+ * larger than this, when it is compressed block by block like a single file */
+const size_t BATCH_IN_MEMORY = 64 << 20;
+
+/* structure used to share out the files of a batch among the workers, which
+ * take the next file from it whenever they finish one */
+struct batch
+{
+    vector <string> * files;
+    atomic <size_t> next;         // the next file to be taken
+    atomic <size_t> failed;       // files that could not be compressed
+    huffoptions opts;
+    size_t blockSize;
+    const huffdict * dict;        // compress each file as a message, if given
+    huffstats * stats;
+    mutex  lock;                  // held to report errors and add up the stats
+};
+
+/* structure used to hold what a worker keeps from one file to the next, so
+ * that a batch allocates little more than one file would */
+struct batchworker
+{
+    huffcontext ctx;
+    vector <unsigned char> contents;   // a file that could not be mapped
+    vector <unsigned char> compressed;
+    huffstats stats;
+};
+
+/* function prototypes */
+void   huffCompressBatch(vector <string> &files, const huffoptions &opts, size_t blockSize,
+                         int nthreads, const huffdict * dict, huffstats * stats);
+void   runBatch(batch * b);
+bool   compressFile(batch * b, batchworker &w, string infilename, string outfilename);
+void   reportError(batch * b, string message);
+bool   readList(string listfilename, vector <string> &files);
+
+/* this function will compress every one of the files to a file of the same
+ * name with .bin added, on nthreads threads at once, in the block format with
+ * the options given or, with a dictionary, as messages; a file that cannot be compressed is
+ * reported and the rest are still compressed. If stats is given, the figures
+ * for every file are added to it */
+inline void huffCompressBatch(vector <string> &files, const huffoptions &opts,
+                              size_t blockSize = DEFAULT_BLOCK_SIZE, int nthreads = 1,
+                              const huffdict * dict = NULL, huffstats * stats = NULL)
+{
+    batch b;
+    b.files = &files;
+    b.next = 0;
+    b.failed = 0;
+    b.opts = opts;
+    b.blockSize = blockSize;
+    b.dict = dict;
+    b.stats = stats;
+
+    // there is no point in more workers than files
+    threadpool pool;
+    int nworkers = (int)min((size_t)nthreads, max(files.size(), (size_t)1));
+    startPool(pool, nworkers);
+    for (int i = 0; i < nworkers; i++)
+        submitTask(pool, bind(runBatch, &b));
+    stopPool(pool);
+
+    if (b.failed > 0)
+        cerr << "Error. " << b.failed << " of " << files.size()
+             << " files could not be compressed." << endl;
+}
+
+/* this function is run by each worker, compressing the files it takes from
+ * the batch one after another with the same context and buffers */
+inline void runBatch(batch * b)
+{
+    batchworker w;
+    initContext(w.ctx, b -> opts.maxCodeLen, b -> blockSize, b -> opts.nstreams);
+    w.ctx.opts = b -> opts;
+    if (b -> stats)
+        initStats(w.stats, COMPRESS_STAGES, NCOMPRESS_STAGES);
+    size_t i;
+    while ((i = b -> next++) < b -> files -> size())
+    {
+        string &infilename = (*b -> files)[i];
+        if (!compressFile(b, w, infilename, infilename + ".bin"))
+            b -> failed++;
+    }
+    if (b -> stats)
+    {
+        lock_guard <mutex> guard(b -> lock);
+        mergeStats(*b -> stats, w.stats);
+    }
+}
+
+/* this function will compress one file of a batch: the input is opened once,
+ * mapped wherever it can be, compressed in memory with the worker's context,
+ * and written out in a single write */
+inline bool compressFile(batch * b, batchworker &w, string infilename, string outfilename)
+{
+    huffstats * stats = b -> stats ? &w.stats : NULL;
+    stagetimer timer = { 0, 0 };
+    startStage(stats, timer);
+    if (infilename == "-")
+    {
+        reportError(b, "Error. Standard input cannot be compressed in a batch.");
+        return false;
+    }
+    inputfile infile;
+    if (!openInput(infilename, infile))
+    {
+        reportError(b, "Error. Could not open file '" + infilename + "'.");
+        return false;
+    }
+    const unsigned char * contents = infile.data;
+    size_t n = infile.size;
+    if (contents == NULL)
+    {
+        if (!readWhole(infile, w.contents))
+        {
+            closeInput(infile);
+            reportError(b, "Error while reading file '" + infilename + "'.");
+            return false;
+        }
+        contents = w.contents.size() ? &w.contents[0] : NULL;
+        n = w.contents.size();
+    }
+    endStage(stats, READ_STAGE, timer);
+    /* a large file is compressed block by block rather than held whole, and
+     * counts as failed if that reports an error; its errors are collected and
+     * printed under the batch's lock like the others */
+    if (n > BATCH_IN_MEMORY && b -> dict == NULL)
+    {
+        closeInput(infile);
+        ostringstream errors;
+        bool done = huffCompress(infilename, outfilename, b -> opts, b -> blockSize, 1, stats,
+                                 errors);
+        string message = errors.str();
+        if (!message.empty())
+            reportError(b, message.substr(0, message.size() - 1));
+        return done;
+    }
+
+    // the output buffer only ever grows, to fit the largest file so far
+    size_t bound = b -> dict ? huffMessageBound(n) : huffCompressBound(n, b -> blockSize);
+    if (w.compressed.size() < bound)
+        w.compressed.resize(bound);
+    huffbuffer out = { &w.compressed[0], bound, 0 };
+    bool compressed;
+    if (b -> dict)
+    {
+        compressed = huffCompressMessage(w.ctx, *b -> dict, contents, n, out);
+        if (stats && compressed)
+        {
+            stats -> bytesIn += n;
+            stats -> bytesOut += out.size;
+        }
+    }
+    else
+        compressed = huffCompressBuffer(w.ctx, contents, n, out, stats);
+    closeInput(infile);
+    if (!compressed)
+    {
+        reportError(b, "Error. Could not compress file '" + infilename + "'.");
+        return false;
+    }
+    startStage(stats, timer);
+
+    ofstream outfile(outfilename.c_str(), ios::binary | ios::trunc);
+    if (!outfile.is_open())
+    {
+        reportError(b, "Error. Could not open file '" + outfilename + "'.");
+        return false;
+    }
+    if (!outfile.write((char *)out.data, out.size) || !outfile.flush())
+    {
+        reportError(b, "Error while writing file '" + outfilename + "'.");
+        return false;
+    }
+    endStage(stats, WRITE_STAGE, timer);
+    return true;
+}
+
+/* this function will print an error for one file of a batch, one worker at a
+ * time so that the messages are not mixed up */
+inline void reportError(batch * b, string message)
+{
+    lock_guard <mutex> guard(b -> lock);
+    cerr << message << endl;
+}
+
+/* this function will add the file names listed one to a line in the list file,
+ * or on standard input if it is "-", to files, skipping blank lines */
+inline bool readList(string listfilename, vector <string> &files)
+{
+    ifstream listfile;
+    if (listfilename != "-")
+    {
+        listfile.open(listfilename.c_str());
+        if (!listfile.is_open())
+            return false;
+    }
+    istream &list = listfilename != "-" ? (istream &)listfile : cin;
+    string line;
+    while (getline(list, line))
+    {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (!line.empty())
+            files.push_back(line);
+    }
+    return !list.bad();
+}
+
+#endif
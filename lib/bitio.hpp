@@ -0,0 +1,233 @@
+/* bitio.hpp
+ * Written by:  Keefer Rourke
+ * License:     GPLv3
+ *
+ * COPYRIGHT    Keefer Rourke 2015
+ *
+ * Description: This header file contains a set of functions required
+ *              for packing variable length codes into a stream of bytes
+ *              and reading them back out, most significant bit first
+ *
+ * Disclaimer:  This program is free software: you can redistribute it
+ *              and/or modify it under the terms of the GNU General
+ *              Public License as published by the Free Software
+ *              Foundation, either version 3 of the License, or (at
+ *              your option) any later version.
+ *
+ *              This program is distributed in the hope that it will
+ *              be useful, but WITHOUT ANY WARRANTY; without even the
+ *              implied warranty of MERCHANTABILITY or FITNESS FOR A
+ *              PARTICULAR PURPOSE.  See the GNU General Public License
+ *              for more details.
+ *
+ *              You should have received a copy of the GNU General
+ *              Public License along with this program.  If not, see
+ *              <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __BITIO_HPP__
+#define __BITIO_HPP__
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+typedef unsigned int uint;
+
+/* structure used to pack codes into bytes; bits collect in a 64 bit
+ * accumulator and every whole byte in it is written out to the byte buffer
+ * with a single 8 byte store */
+struct bitwriter
+{
+    vector <unsigned char> bytes; // packed output, valid up to pos
+    size_t pos;                   // number of bytes written
+    unsigned long long acc;       // pending bits, right aligned
+    int    nbits;                 // number of pending bits in acc
+};
+
+/* structure used to read codes back out of a packed byte buffer */
+struct bitreader
+{
+    const unsigned char * bytes;
+    size_t nbytes;
+    size_t pos;             // next byte to load, counting past the end
+    unsigned long long acc; // bits waiting to be consumed, left aligned
+    int    nbits;           // number of valid bits in acc
+};
+
+/* function prototypes */
+void   initWriter(bitwriter &bw, size_t reserve = 0);
+void   putBits(bitwriter &bw, uint code, int len);
+void   appendBits(bitwriter &bw, uint code, int len);
+void   flushBits(bitwriter &bw);
+void   storeWord(unsigned char * p, unsigned long long word);
+void   alignBits(bitwriter &bw);
+void   copyBytes(bitwriter &bw, const unsigned char * bytes, size_t n);
+void   finishBits(bitwriter &bw);
+unsigned long long bitsWritten(bitwriter &bw);
+void   initReader(bitreader &br, const unsigned char * bytes, size_t nbytes);
+/* the decoders call these for every code, so they are inline to let the bit
+ * readers stay in registers */
+inline void refill(bitreader &br);
+inline uint peekBits(bitreader &br, int n);
+inline void consumeBits(bitreader &br, int n);
+unsigned long long bitsRead(bitreader &br);
+
+/* this function will prepare an empty bit writer, optionally reserving room
+ * for the number of bytes expected so the buffer does not have to grow */
+inline void initWriter(bitwriter &bw, size_t reserve)
+{
+    bw.bytes.assign(reserve + 8, 0);
+    bw.pos   = 0;
+    bw.acc   = 0;
+    bw.nbits = 0;
+}
+
+/* this function will append the low len bits of code (at most 32) to the
+ * stream, writing out whole bytes whenever 4 or more are ready */
+inline void putBits(bitwriter &bw, uint code, int len)
+{
+    appendBits(bw, code, len);
+    if (bw.nbits >= 32)
+        flushBits(bw);
+}
+
+/* this function will append the low len bits of code to the accumulator
+ * without writing anything out; the caller must call flushBits before more
+ * than 64 bits are pending */
+inline void appendBits(bitwriter &bw, uint code, int len)
+{
+    bw.acc    = (bw.acc << len) | code;
+    bw.nbits += len;
+}
+
+/* this function will write every whole byte pending in the accumulator out to
+ * the buffer, leaving fewer than 8 bits pending; all 8 bytes are stored at
+ * once and the position only advances over the whole ones */
+inline void flushBits(bitwriter &bw)
+{
+    if (bw.nbits < 8)
+        return;
+    if (bw.pos + 8 > bw.bytes.size())
+        bw.bytes.resize(bw.bytes.size() * 2);
+    storeWord(&bw.bytes[bw.pos], bw.acc << (64 - bw.nbits));
+    bw.pos   += bw.nbits >> 3;
+    bw.nbits &= 7;
+}
+
+/* this function will store 8 bytes, most significant first */
+inline void storeWord(unsigned char * p, unsigned long long word)
+{
+#ifdef __GNUC__
+    // a byte swap and a single store where the compiler has them
+    word = __builtin_bswap64(word);
+    memcpy(p, &word, sizeof(word));
+#else
+    for (int i = 0; i < 8; i++)
+        p[i] = (unsigned char)(word >> (56 - 8 * i));
+#endif
+}
+
+/* this function will pad the stream with zeros to a whole byte, so that the
+ * next bits put into it start a byte of their own */
+inline void alignBits(bitwriter &bw)
+{
+    int pad = (8 - (bw.nbits & 7)) & 7;
+    appendBits(bw, 0, pad);
+    flushBits(bw);
+}
+
+/* this function will append n whole bytes to a stream that is at a whole
+ * byte, as they are, without going through the accumulator */
+inline void copyBytes(bitwriter &bw, const unsigned char * bytes, size_t n)
+{
+    flushBits(bw);
+    if (bw.pos + n + 8 > bw.bytes.size())
+        bw.bytes.resize(bw.pos + n + 8);
+    if (n > 0)
+        memcpy(&bw.bytes[bw.pos], bytes, n);
+    bw.pos += n;
+}
+
+/* this function will write out any pending bits, padding the last byte with
+ * zeros, and trim the buffer to the bytes written */
+inline void finishBits(bitwriter &bw)
+{
+    unsigned long long total = bitsWritten(bw);
+    flushBits(bw);
+    if (bw.nbits > 0)
+    {
+        // the last bits go at the top of a byte of their own
+        bw.bytes.resize(bw.pos + 1);
+        bw.bytes[bw.pos++] = (unsigned char)(bw.acc << (8 - bw.nbits));
+        bw.nbits = 0;
+    }
+    bw.bytes.resize((total + 7) / 8);
+}
+
+/* this function will return the number of bits put into the stream so far */
+inline unsigned long long bitsWritten(bitwriter &bw)
+{
+    return (unsigned long long)bw.pos * 8 + bw.nbits;
+}
+
+/* this function will prepare a bit reader to read from a block of bytes */
+inline void initReader(bitreader &br, const unsigned char * bytes, size_t nbytes)
+{
+    br.bytes  = bytes;
+    br.nbytes = nbytes;
+    br.pos    = 0;
+    br.acc    = 0;
+    br.nbits  = 0;
+}
+
+/* this function will top up the bit reader so that at least 56 bits are
+ * available; past the end of the bytes it reads zeros, but still counts
+ * them so that the caller can tell how far it has read */
+inline void refill(bitreader &br)
+{
+    if (br.pos + 8 <= br.nbytes)
+    {
+        // load 8 bytes at once and keep as many whole bytes as fit
+        const unsigned char * p = br.bytes + br.pos;
+        unsigned long long word = 0;
+        for (int i = 0; i < 8; i++)
+            word = (word << 8) | p[i];
+        br.acc   |= word >> br.nbits;
+        br.pos   += (63 - br.nbits) >> 3;
+        br.nbits |= 56;
+        return;
+    }
+    while (br.nbits <= 56)
+    {
+        unsigned long long byte = 0;
+        if (br.pos < br.nbytes)
+            byte = br.bytes[br.pos];
+        br.pos++;
+        br.acc   |= byte << (56 - br.nbits);
+        br.nbits += 8;
+    }
+}
+
+/* this function will return the next n bits of the stream without consuming them */
+inline uint peekBits(bitreader &br, int n)
+{
+    return (uint)(br.acc >> (64 - n));
+}
+
+/* this function will drop the next n bits of the stream */
+inline void consumeBits(bitreader &br, int n)
+{
+    br.acc  <<= n;
+    br.nbits -= n;
+}
+
+/* this function will return the number of bits consumed from the stream so far */
+inline unsigned long long bitsRead(bitreader &br)
+{
+    return (unsigned long long)br.pos * 8 - br.nbits;
+}
+
+#endif
@@ -0,0 +1,262 @@
+/* codec.hpp
+ * Written by:  Keefer Rourke
+ * License:     GPLv3
+ *
+ * COPYRIGHT    Keefer Rourke 2015
+ *
+ * Description: This header file contains a set of functions required
+ *              for compressing a buffer in memory into a Huffman binary
+ *              buffer and extracting it again, so that the codec can be
+ *              used as a library without touching the filesystem
+ *
+ * Disclaimer:  This program is free software: you can redistribute it
+ *              and/or modify it under the terms of the GNU General
+ *              Public License as published by the Free Software
+ *              Foundation, either version 3 of the License, or (at
+ *              your option) any later version.
+ *
+ *              This program is distributed in the hope that it will
+ *              be useful, but WITHOUT ANY WARRANTY; without even the
+ *              implied warranty of MERCHANTABILITY or FITNESS FOR A
+ *              PARTICULAR PURPOSE.  See the GNU General Public License
+ *              for more details.
+ *
+ *              You should have received a copy of the GNU General
+ *              Public License along with this program.  If not, see
+ *              <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __CODEC_HPP__
+#define __CODEC_HPP__
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include "huff.hpp"
+#include "puff.hpp"
+
+using namespace std;
+typedef unsigned int uint;
+
+/* structure used to keep the options and the working memory of the buffer
+ * functions from one call to the next; once its memory has grown to fit the
+ * blocks it is given, compressing and extracting allocate nothing except when
+ * codes have to be shortened. A context is used by one thread at a time */
+struct huffcontext
+{
+    huffoptions opts;
+    size_t blockSize;
+    bitwriter header;
+    bitwriter encodedText;
+    blockscratch scratch;
+    repeatchain chain;
+    blocksplitter splitter;
+    decodescratch decodeScratch;
+    vector <blockindex> index;
+    huffstats blockStats;   // figures for the block being compressed, when wanted
+};
+
+/* structure used to describe a buffer supplied by the caller, of which size
+ * bytes are filled in */
+struct huffbuffer
+{
+    unsigned char * data;
+    size_t capacity;
+    size_t size;
+};
+
+/* function prototypes */
+bool   initContext(huffcontext &ctx, int maxCodeLen = DEFAULT_MAX_CODE_LEN,
+                   size_t blockSize = DEFAULT_BLOCK_SIZE, int nstreams = 1,
+                   bool contexts = false);
+size_t huffCompressBound(size_t n, size_t blockSize = DEFAULT_BLOCK_SIZE);
+size_t blockBound(size_t n);
+bool   huffCompressBuffer(huffcontext &ctx, const unsigned char * in, size_t n,
+                          huffbuffer &out, huffstats * stats = NULL);
+bool   huffExtractedSize(const unsigned char * in, size_t n, unsigned long long &size);
+bool   huffExtractBuffer(huffcontext &ctx, const unsigned char * in, size_t n,
+                         huffbuffer &out);
+bool   putBytes(huffbuffer &out, const void * bytes, size_t n);
+
+/* this function will set the options a context compresses with, the same as
+ * huffCompress takes, returning false if they are not ones it can use */
+inline bool initContext(huffcontext &ctx, int maxCodeLen, size_t blockSize, int nstreams,
+                        bool contexts)
+{
+    if (maxCodeLen < 8 || maxCodeLen > MAX_CODE_LEN)
+        return false;
+    if (blockSize == 0 || blockSize > MAX_BLOCK_SIZE)
+        return false;
+    if (nstreams < 1 || nstreams > MAX_STREAMS || (nstreams & (nstreams - 1)))
+        return false;
+    initOptions(ctx.opts, maxCodeLen, nstreams, contexts);
+    ctx.blockSize = blockSize;
+    return true;
+}
+
+/* this function will return the most bytes that n characters can compress
+ * to in blocks of blockSize characters, so that an output buffer of this size
+ * is always big enough; split where the characters change, every block but
+ * the last is still at least SPLIT_STEP characters, or blockSize if less */
+inline size_t huffCompressBound(size_t n, size_t blockSize)
+{
+    const size_t entrySize = sizeof(unsigned long long) + 2 * sizeof(uint);
+    // the magic bytes, the end marker, the number of blocks and the length
+    size_t bound = sizeof(HUFF_MAGIC) + sizeof(uint) + 2 * sizeof(unsigned long long);
+    size_t blocks = n / min(blockSize, SPLIT_STEP) + 1;
+    return bound + blocks * (blockBound(0) + entrySize) + n;
+}
+
+/* this function will return the most bytes a block of n characters can take:
+ * a block is only coded when that takes fewer bytes than the n characters
+ * themselves, and is stored after the byte giving its type otherwise */
+inline size_t blockBound(size_t n)
+{
+    return 2 * sizeof(uint) + 1 + n;
+}
+
+/* this function will compress the n characters at in into out, in the same
+ * format huffCompress writes to a file, returning false if out is too small;
+ * an out of huffCompressBound bytes is never too small. If stats is given,
+ * the figures for each block are added to it */
+inline bool huffCompressBuffer(huffcontext &ctx, const unsigned char * in, size_t n,
+                               huffbuffer &out, huffstats * stats)
+{
+    out.size = 0;
+    if (!putBytes(out, HUFF_MAGIC, sizeof(HUFF_MAGIC)))
+        return false;
+
+    ctx.index.clear();
+    initChain(ctx.chain);
+    initSplitter(ctx.splitter);
+    size_t m;
+    for (size_t pos = 0; pos < n; pos += m)
+    {
+        m = min(ctx.blockSize, n - pos);
+        // split the way splitContents splits a file, up to a block size at a time
+        blocksplitter &splitter = ctx.splitter;
+        if (ctx.opts.split && splitter.next == splitter.lengths.size())
+        {
+            splitBlocks(in + pos, m, splitter);
+            if (m == ctx.blockSize && splitter.lengths.size() > 1)
+                splitter.lengths.pop_back();
+        }
+        if (ctx.opts.split)
+            m = splitter.lengths[splitter.next++];
+        if (stats)
+            initStats(ctx.blockStats, stats -> stages, stats -> nstages);
+        compressBlock(in + pos, m, ctx.opts, ctx.header, ctx.encodedText, ctx.scratch,
+                      ctx.chain, ctx.index.size(), stats ? &ctx.blockStats : NULL);
+        if (stats)
+            mergeStats(*stats, ctx.blockStats);
+        finishBits(ctx.header);
+        finishBits(ctx.encodedText);
+
+        // each block is laid out as writeToFile writes it
+        blockindex entry;
+        entry.offset = out.size;
+        entry.sizeofBlock = m;
+        entry.sizeofText = ctx.header.bytes.size() + ctx.encodedText.bytes.size();
+        if (!putBytes(out, &entry.sizeofBlock, sizeof(entry.sizeofBlock))
+            || !putBytes(out, &entry.sizeofText, sizeof(entry.sizeofText))
+            || !putBytes(out, &ctx.header.bytes[0], ctx.header.bytes.size())
+            || !putBytes(out, ctx.encodedText.bytes.size() ? &ctx.encodedText.bytes[0] : NULL,
+                         ctx.encodedText.bytes.size()))
+            return false;
+        ctx.index.push_back(entry);
+    }
+
+    // and the trailer as writeTrailer writes it
+    uint endOfBlocks = 0;
+    unsigned long long nblocks = ctx.index.size();
+    unsigned long long sizeofFile = n;
+    if (!putBytes(out, &endOfBlocks, sizeof(endOfBlocks)))
+        return false;
+    for (size_t i = 0; i < ctx.index.size(); i++)
+    {
+        if (!putBytes(out, &ctx.index[i].offset, sizeof(ctx.index[i].offset))
+            || !putBytes(out, &ctx.index[i].sizeofBlock, sizeof(ctx.index[i].sizeofBlock))
+            || !putBytes(out, &ctx.index[i].sizeofText, sizeof(ctx.index[i].sizeofText)))
+            return false;
+    }
+    bool done = putBytes(out, &nblocks, sizeof(nblocks))
+                && putBytes(out, &sizeofFile, sizeof(sizeofFile));
+    if (done && stats)
+        stats -> bytesOut += out.size;
+    return done;
+}
+
+/* this function will find how many characters the n bytes of a Huffman binary
+ * at in extract to, from the end of it, so that the caller can size the
+ * buffer to extract into; it returns false if in is not a Huffman binary */
+inline bool huffExtractedSize(const unsigned char * in, size_t n, unsigned long long &size)
+{
+    if (n < sizeof(HUFF_MAGIC) + sizeof(uint) + 2 * sizeof(unsigned long long)
+        || memcmp(in, HUFF_MAGIC, sizeof(HUFF_MAGIC)) != 0)
+        return false;
+    memcpy(&size, in + n - sizeof(size), sizeof(size));
+    return true;
+}
+
+/* this function will extract the n bytes of a Huffman binary at in into out,
+ * returning false if it is not a valid binary or out is too small */
+inline bool huffExtractBuffer(huffcontext &ctx, const unsigned char * in, size_t n,
+                              huffbuffer &out)
+{
+    const size_t entrySize = sizeof(unsigned long long) + 2 * sizeof(uint);
+    unsigned long long sizeofFile, nblocks;
+    out.size = 0;
+    if (!huffExtractedSize(in, n, sizeofFile) || sizeofFile > out.capacity)
+        return false;
+    memcpy(&nblocks, in + n - 2 * sizeof(unsigned long long), sizeof(nblocks));
+
+    // decode the blocks straight into the caller's buffer, in order
+    ctx.decodeScratch.repeatCodes.clear();
+    size_t pos = sizeof(HUFF_MAGIC);
+    unsigned long long blocks = 0;
+    while (true)
+    {
+        uint sizeofBlock, sizeofText;
+        if (n - pos < sizeof(sizeofBlock))
+            return false;
+        memcpy(&sizeofBlock, in + pos, sizeof(sizeofBlock));
+        pos += sizeof(sizeofBlock);
+        if (sizeofBlock == 0)
+            break;
+        if (n - pos < sizeof(sizeofText))
+            return false;
+        memcpy(&sizeofText, in + pos, sizeof(sizeofText));
+        pos += sizeof(sizeofText);
+        if (sizeofText > n - pos || sizeofBlock > sizeofFile - out.size)
+            return false;
+
+        bool validHeader;
+        if (!decodeBlock(in + pos, sizeofText, (char *)out.data + out.size, sizeofBlock,
+                         ctx.decodeScratch, validHeader))
+            return false;
+        out.size += sizeofBlock;
+        pos += sizeofText;
+        blocks++;
+    }
+
+    /* the blocks are followed by their index, which is not needed when reading
+     * them in order, then the number of blocks and the length of the whole
+     * buffer, which have to match */
+    return blocks == nblocks && out.size == sizeofFile
+           && n - pos == nblocks * entrySize + 2 * sizeof(unsigned long long);
+}
+
+/* this function will append n bytes to the buffer, returning false if they
+ * do not fit */
+inline bool putBytes(huffbuffer &out, const void * bytes, size_t n)
+{
+    if (n > out.capacity - out.size)
+        return false;
+    if (n > 0)
+        memcpy(out.data + out.size, bytes, n);
+    out.size += n;
+    return true;
+}
+
+#endif
@@ -0,0 +1,415 @@
+/* dict.hpp
+ * Written by:  Keefer Rourke
+ * License:     GPLv3
+ *
+ * COPYRIGHT    Keefer Rourke 2015
+ *
+ * Description: This header file contains a set of functions required
+ *              for training a dictionary of codes on sample text, and
+ *              compressing small messages with it, so that a message
+ *              refers to the dictionary by its ID instead of carrying
+ *              codes of its own
+ *
+ * Disclaimer:  This program is free software: you can redistribute it
+ *              and/or modify it under the terms of the GNU General
+ *              Public License as published by the Free Software
+ *              Foundation, either version 3 of the License, or (at
+ *              your option) any later version.
+ *
+ *              This program is distributed in the hope that it will
+ *              be useful, but WITHOUT ANY WARRANTY; without even the
+ *              implied warranty of MERCHANTABILITY or FITNESS FOR A
+ *              PARTICULAR PURPOSE.  See the GNU General Public License
+ *              for more details.
+ *
+ *              You should have received a copy of the GNU General
+ *              Public License along with this program.  If not, see
+ *              <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __DICT_HPP__
+#define __DICT_HPP__
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include "huff.hpp"
+#include "puff.hpp"
+#include "codec.hpp"
+
+using namespace std;
+typedef unsigned int uint;
+
+/* structure used to hold a dictionary: a code for every character, trained on
+ * sample text, and the tables to code and decode with, which are built once
+ * when it is trained or loaded so that no message has to build them; once
+ * built it is only read, so any number of threads can share it */
+struct huffdict
+{
+    uint id;                      // identifies the codes in every message
+    vector <huffcode> codes;
+    encodeEntry encodeTable[256];
+    int longest;                  // length of the longest code
+    vector <decodeEntry> decodeTable;
+};
+
+/* function prototypes */
+void   huffTrain(vector <string> &samples, string dictfilename,
+                 int maxCodeLen = DEFAULT_MAX_CODE_LEN);
+void   trainDict(huffdict &dict, unsigned long long counts[256], int maxCodeLen);
+void   buildDict(huffdict &dict);
+uint   dictId(vector <huffcode> &codes);
+bool   saveDict(string dictfilename, huffdict &dict);
+bool   loadDict(string dictfilename, huffdict &dict);
+void   huffCompressDict(string infilename, string outfilename, const huffdict &dict);
+void   huffExtractDict(string infilename, string outfilename, const huffdict &dict);
+size_t huffMessageBound(size_t n);
+bool   huffCompressMessage(huffcontext &ctx, const huffdict &dict, const unsigned char * in,
+                           size_t n, huffbuffer &out);
+bool   huffMessageSize(const unsigned char * in, size_t n, unsigned long long &size);
+bool   huffExtractMessage(const huffdict &dict, const unsigned char * in, size_t n,
+                          huffbuffer &out);
+bool   readMessageHeader(const unsigned char * in, size_t n, uint &id,
+                         unsigned long long &count, size_t &pos);
+bool   putVarint(huffbuffer &out, unsigned long long v);
+bool   getVarint(const unsigned char * in, size_t n, size_t &pos, unsigned long long &v);
+
+/* this function will count the characters of every sample file, train a
+ * dictionary on them with codes of at most maxCodeLen bits, and write it to
+ * the dictionary file */
+inline void huffTrain(vector <string> &samples, string dictfilename, int maxCodeLen)
+{
+    unsigned long long counts[256] = { 0 };
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        inputfile infile;
+        if (!openInput(samples[i], infile))
+        {
+            cerr << "Error. Could not open file '" << samples[i] << "'." << endl;
+            return;
+        }
+        const unsigned char * block;
+        size_t n;
+        while (getContents(infile, DEFAULT_BLOCK_SIZE, block, n))
+            countBytes(block, n, counts);
+        bool failed = infile.failed;
+        closeInput(infile);
+        if (failed)
+        {
+            cerr << "Error while reading file '" << samples[i] << "'." << endl;
+            return;
+        }
+    }
+
+    huffdict dict;
+    trainDict(dict, counts, maxCodeLen);
+    if (!saveDict(dictfilename, dict))
+        cerr << "Error while writing file '" << dictfilename << "'." << endl;
+}
+
+/* this function will build a dictionary's codes from the counts of the sample
+ * text; every character gets a code however rare it was, so that any message
+ * can be compressed with them */
+inline void trainDict(huffdict &dict, unsigned long long counts[256], int maxCodeLen)
+{
+    // the counts are scaled down to fit the frequencies of a tree
+    unsigned long long most = 0;
+    for (int c = 0; c < 256; c++)
+        most = max(most, counts[c]);
+    int shift = 0;
+    while ((most >> shift) > (1u << 24))
+        shift++;
+    unsigned long long scaled[256];
+    for (int c = 0; c < 256; c++)
+        scaled[c] = (counts[c] >> shift) + 1;
+
+    vector <cfreq> cfreqs;
+    hufftree tree;
+    rebuildCodes(scaled, maxCodeLen, cfreqs, tree, dict.codes);
+    buildDict(dict);
+}
+
+/* this function will build the tables for the codes of a dictionary, and
+ * find its ID */
+inline void buildDict(huffdict &dict)
+{
+    buildEncodeTable(dict.codes, dict.encodeTable);
+    dict.longest = 0;
+    for (size_t i = 0; i < dict.codes.size(); i++)
+        dict.longest = max(dict.longest, dict.codes[i].len);
+    hufftree tree;
+    rebuildHuffTree(dict.codes, tree);
+    buildDecodeTable(tree, dict.decodeTable);
+    dict.id = dictId(dict.codes);
+}
+
+/* this function will find the ID of a set of codes, a 32 bit FNV-1a hash of
+ * the length of every character's code, so that dictionaries with the same
+ * codes have the same ID and a message is never decoded with the wrong one */
+inline uint dictId(vector <huffcode> &codes)
+{
+    unsigned char lens[256] = { 0 };
+    for (size_t i = 0; i < codes.size(); i++)
+        lens[(unsigned char)codes[i].c] = codes[i].len;
+    uint hash = 2166136261u;
+    for (int c = 0; c < 256; c++)
+    {
+        hash ^= lens[c];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* this function will write a dictionary file: the magic bytes, the ID, and the
+ * code lengths in the same form as the header of a block with one stream, so
+ * that readHeader can read them back */
+inline bool saveDict(string dictfilename, huffdict &dict)
+{
+    bitwriter header;
+    initWriter(header);
+    vector <uint> sizes(1, 0);
+    writeCodeLengths(dict.codes, header);
+    writeStreamTable(sizes, header);
+    finishBits(header);
+    uint sizeofHeader = header.bytes.size();
+
+    ofstream outfile(dictfilename.c_str(), ios::binary | ios::trunc);
+    if (!outfile.is_open())
+        return false;
+    outfile.write(DICT_MAGIC, sizeof(DICT_MAGIC));
+    outfile.write((char *)&dict.id, sizeof(dict.id));
+    outfile.write((char *)&sizeofHeader, sizeof(sizeofHeader));
+    outfile.write((char *)&header.bytes[0], sizeofHeader);
+    return outfile.good();
+}
+
+/* this function will read a dictionary file and build its tables, returning
+ * false unless it holds a code for every character and the ID matches them */
+inline bool loadDict(string dictfilename, huffdict &dict)
+{
+    ifstream infile(dictfilename.c_str(), ios::binary);
+    char magic[sizeof(DICT_MAGIC)];
+    uint id, sizeofHeader;
+    if (!infile.read(magic, sizeof(magic)) || memcmp(magic, DICT_MAGIC, sizeof(magic)) != 0
+        || !infile.read((char *)&id, sizeof(id))
+        || !infile.read((char *)&sizeofHeader, sizeof(sizeofHeader)) || sizeofHeader > 1024)
+        return false;
+    vector <unsigned char> header(sizeofHeader + 1);
+    if (!infile.read((char *)&header[0], sizeofHeader))
+        return false;
+
+    size_t pos = 0;
+    vector <size_t> streamSizes;
+    if (!readHeader(&header[0], sizeofHeader, pos, dict.codes, streamSizes)
+        || dict.codes.size() != 256)
+        return false;
+    buildDict(dict);
+    return dict.id == id;
+}
+
+/* this function will compress the input as a single message with the codes
+ * of the dictionary; messages are small, so it is read whole */
+inline void huffCompressDict(string infilename, string outfilename, const huffdict &dict)
+{
+    inputfile infile;
+    if (!openInput(infilename, infile))
+    {
+        cerr << "Error. Could not open file '" << infilename << "'." << endl;
+        return;
+    }
+    vector <unsigned char> contents;
+    bool read = readWhole(infile, contents);
+    closeInput(infile);
+    if (!read)
+    {
+        cerr << "Error while reading file '" << infilename << "'." << endl;
+        return;
+    }
+
+    huffcontext ctx;
+    vector <unsigned char> message(huffMessageBound(contents.size()));
+    huffbuffer out = { &message[0], message.size(), 0 };
+    huffCompressMessage(ctx, dict, contents.size() ? &contents[0] : NULL, contents.size(), out);
+
+    ofstream outfile;
+    if (outfilename != "-")
+    {
+        outfile.open(outfilename.c_str(), ios::binary | ios::trunc);
+        if (!outfile.is_open())
+        {
+            cerr << "Error. Could not open file '" << outfilename << "'." << endl;
+            return;
+        }
+    }
+    ostream &o = outfilename != "-" ? (ostream &)outfile : cout;
+    if (!o.write((char *)out.data, out.size) || !o.flush())
+        cerr << "Error while writing file '" << outfilename << "'." << endl;
+}
+
+/* this function will extract a message that was compressed with the codes of
+ * the dictionary */
+inline void huffExtractDict(string infilename, string outfilename, const huffdict &dict)
+{
+    inputfile infile;
+    if (!openInput(infilename, infile))
+    {
+        cerr << "Error. Could not open file '" << infilename << "'." << endl;
+        return;
+    }
+    vector <unsigned char> message;
+    bool read = readWhole(infile, message);
+    closeInput(infile);
+    if (!read)
+    {
+        cerr << "Error while reading file '" << infilename << "'." << endl;
+        return;
+    }
+
+    const unsigned char * in = message.size() ? &message[0] : NULL;
+    uint id;
+    unsigned long long count;
+    size_t pos = 0;
+    if (!readMessageHeader(in, message.size(), id, count, pos))
+    {
+        cerr << "Error. '" << infilename << "' is not a message compressed with a dictionary."
+             << endl;
+        return;
+    }
+    if (id != dict.id)
+    {
+        cerr << "Error. '" << infilename << "' was compressed with dictionary " << hex << id
+             << ", not " << dict.id << dec << "." << endl;
+        return;
+    }
+    // every character takes at least one bit, which bounds the length
+    if (count > (message.size() - pos) * 8)
+    {
+        cerr << "Error. '" << infilename << "' is truncated or corrupt." << endl;
+        return;
+    }
+    vector <unsigned char> text(count + 1);
+    huffbuffer out = { &text[0], count, 0 };
+    if (!huffExtractMessage(dict, in, message.size(), out))
+    {
+        cerr << "Error. '" << infilename << "' is truncated or corrupt." << endl;
+        return;
+    }
+
+    ofstream outfile;
+    if (outfilename != "-")
+    {
+        outfile.open(outfilename.c_str(), ios::binary | ios::trunc);
+        if (!outfile.is_open())
+        {
+            cerr << "Error. Could not open file '" << outfilename << "'." << endl;
+            return;
+        }
+    }
+    ostream &o = outfilename != "-" ? (ostream &)outfile : cout;
+    if (!o.write((char *)out.data, out.size) || !o.flush())
+        cerr << "Error while writing file '" << outfilename << "'." << endl;
+}
+
+/* this function will return the most bytes a message of n characters can
+ * take: the magic bytes, the ID, the length in at most 10 bytes, and codes of
+ * at most MAX_CODE_LEN bits */
+inline size_t huffMessageBound(size_t n)
+{
+    return sizeof(MESSAGE_MAGIC) + sizeof(uint) + 10 + (n * MAX_CODE_LEN + 7) / 8;
+}
+
+/* this function will compress the n characters at in into out as a message:
+ * the magic bytes, the dictionary's ID and the number of characters, which
+ * take 9 bytes for messages of up to 127 characters and 10 up to 16K, and
+ * then the codes, padded to a whole byte. Nothing is counted or built, and
+ * once ctx has grown to fit the messages nothing is allocated; it returns
+ * false if out is too small, which one of huffMessageBound bytes never is */
+inline bool huffCompressMessage(huffcontext &ctx, const huffdict &dict, const unsigned char * in,
+                                size_t n, huffbuffer &out)
+{
+    out.size = 0;
+    if (!putBytes(out, MESSAGE_MAGIC, sizeof(MESSAGE_MAGIC))
+        || !putBytes(out, &dict.id, sizeof(dict.id)) || !putVarint(out, n))
+        return false;
+    initWriter(ctx.encodedText, n);
+    encodeWithTable(in, n, dict.encodeTable, dict.longest, ctx.encodedText);
+    finishBits(ctx.encodedText);
+    return putBytes(out, ctx.encodedText.bytes.size() ? &ctx.encodedText.bytes[0] : NULL,
+                    ctx.encodedText.bytes.size());
+}
+
+/* this function will find how many characters the n bytes of a message at in
+ * extract to, so that the caller can size the buffer to extract into; it
+ * returns false if in is not a message */
+inline bool huffMessageSize(const unsigned char * in, size_t n, unsigned long long &size)
+{
+    uint id;
+    size_t pos = 0;
+    return readMessageHeader(in, n, id, size, pos);
+}
+
+/* this function will extract the n bytes of a message at in into out,
+ * returning false if it is not a message compressed with this dictionary, or
+ * out is too small */
+inline bool huffExtractMessage(const huffdict &dict, const unsigned char * in, size_t n,
+                               huffbuffer &out)
+{
+    uint id;
+    unsigned long long count;
+    size_t pos = 0;
+    out.size = 0;
+    if (!readMessageHeader(in, n, id, count, pos) || id != dict.id || count > out.capacity)
+        return false;
+    if (!decode(in, n, pos, dict.decodeTable, (char *)out.data, count))
+        return false;
+    out.size = count;
+    return true;
+}
+
+/* this function will read the magic bytes, the dictionary's ID and the number
+ * of characters from the start of a message, leaving pos at its codes */
+inline bool readMessageHeader(const unsigned char * in, size_t n, uint &id,
+                              unsigned long long &count, size_t &pos)
+{
+    if (n < sizeof(MESSAGE_MAGIC) + sizeof(id)
+        || memcmp(in, MESSAGE_MAGIC, sizeof(MESSAGE_MAGIC)) != 0)
+        return false;
+    memcpy(&id, in + sizeof(MESSAGE_MAGIC), sizeof(id));
+    pos = sizeof(MESSAGE_MAGIC) + sizeof(id);
+    return getVarint(in, n, pos, count);
+}
+
+/* this function will append v to the buffer 7 bits at a time, low bits first,
+ * with the top bit of each byte set if another follows */
+inline bool putVarint(huffbuffer &out, unsigned long long v)
+{
+    unsigned char bytes[10];
+    int len = 0;
+    do
+    {
+        bytes[len++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+        v >>= 7;
+    }
+    while (v);
+    return putBytes(out, bytes, len);
+}
+
+/* this function will read a number written by putVarint from pos on,
+ * returning false if it runs past the end of the n bytes */
+inline bool getVarint(const unsigned char * in, size_t n, size_t &pos, unsigned long long &v)
+{
+    v = 0;
+    for (int shift = 0; shift < 64 && pos < n; shift += 7)
+    {
+        unsigned char b = in[pos++];
+        v |= (unsigned long long)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+#endif
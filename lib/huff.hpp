@@ -24,8 +24,7 @@
  *              Public License along with this program.  If not, see
  *              <http://www.gnu.org/licenses/>.
  */
-//NOTES: OUTPUT FILE IS LARGER THAN INPUT FILE HELP 
- 
+
 #ifndef __HUFF_HPP__
 #define __HUFF_HPP__
 
@@ -35,501 +34,2639 @@
 #include <vector>
 #include <algorithm>
 #include <climits>
-#include <bitset>
-#include <cmath>
 #include <cctype>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "bitio.hpp"
+#include "hufftree.hpp"
+#include "adaptive.hpp"
+#include "input.hpp"
+#include "threadpool.hpp"
+#include "stats.hpp"
 
 using namespace std;
 typedef unsigned int uint;
 
+/* the multithreaded byte count only splits the input when every thread gets
+ * at least this many bytes, as starting a thread costs more than counting less */
+const size_t MIN_COUNT_PER_THREAD = 1 << 22;
+
+/* codes are never longer than MAX_CODE_LEN bits, so that their lengths fit in
+ * 4 bits of the header; shorter limits keep the decoding tables small */
+const int MAX_CODE_LEN         = 15;
+const int DEFAULT_MAX_CODE_LEN = 11;
+
+/* every binary file starts with these 4 bytes, so that other files are not
+ * mistaken for one */
+const char HUFF_MAGIC[4] = { 'H', 'U', 'F', 'B' };
+
+/* the header of each block starts with a byte giving how the block is coded:
+ * with one table of codes, with a table chosen for each character by the
+ * character before it, with matches, not at all, as one character repeated,
+ * or with the table of the last block to have one of its own */
+const unsigned char HUFFMAN_BLOCK = 0;
+const unsigned char CONTEXT_BLOCK = 1;
+const unsigned char LZ_BLOCK      = 2;
+const unsigned char STORED_BLOCK  = 3;
+const unsigned char RLE_BLOCK     = 4;
+const unsigned char REPEAT_BLOCK  = 5;
+
+/* a table is repeated by blocks no more than MAX_REPEATS blocks after the
+ * block it was written in, so that extracting a range never has to look
+ * further back than that for it */
+const int MAX_REPEATS = 16;
+
+/* a block is stored as it is unless coding it saves at least MIN_SAVING
+ * percent of it. Whether it can is first judged from the entropy of a sample
+ * of SAMPLE_CHUNK characters out of every SAMPLE_STRIDE, so that a nearly
+ * random block is stored without being counted in full or having codes built */
+const int    MIN_SAVING    = 3;
+const size_t SAMPLE_CHUNK  = 1 << 10;
+const size_t SAMPLE_STRIDE = 1 << 13;
+
+/* with contexts, the 256 characters a character can follow are grouped into
+ * at most MAX_CONTEXT_TABLES tables; blocks of fewer than MIN_CONTEXT_BLOCK
+ * characters are too short to pay for the extra tables. The grouping is
+ * refined CONTEXT_ROUNDS times, and CONTEXT_ESCAPE is the count a table is
+ * taken to have of a character it has not seen, so that it is costly but not
+ * impossible to code */
+const int    MAX_CONTEXT_TABLES = 16;
+const size_t MIN_CONTEXT_BLOCK  = 1 << 12;
+const int    CONTEXT_ROUNDS     = 4;
+const double CONTEXT_ESCAPE     = 0.1;
+
+/* with LZ, a string of MIN_MATCH to MAX_MATCH characters that occurred
+ * earlier in the block, no more than the window back, is coded as its length
+ * and its distance back instead. The lengths take LENGTH_CODES symbols after
+ * the 256 characters, and the distances DIST_CODES symbols of their own, each
+ * followed by extra bits; earlier places to match are found through chains of
+ * the places with the same hash of LZ_HASH_BITS bits */
+const uint   MIN_MATCH      = 3;
+const uint   MAX_MATCH      = 258;
+const int    LENGTH_CODES   = 28;
+const int    LITLEN_SYMBOLS = 256 + LENGTH_CODES;
+const int    DIST_CODES     = 60;
+const int    LZ_HASH_BITS   = 16;
+const size_t MIN_WINDOW     = 1 << 8;
+const size_t DEFAULT_WINDOW = 1 << 20;
+const int    DEFAULT_LZ_LEVEL = 6;
+const int    MAX_LZ_LEVEL     = 9;
+
+/* the compression levels go from 1, the fastest, to MAX_LEVEL, which
+ * compresses the most; without one, the input is compressed as at
+ * DEFAULT_LEVEL */
+const int MAX_LEVEL     = 9;
+const int DEFAULT_LEVEL = 2;
+
+/* the input is compressed in blocks of this many characters by default, each
+ * with codes of its own, so only one block has to be held in memory */
+const size_t DEFAULT_BLOCK_SIZE = 1 << 20;
+const size_t MAX_BLOCK_SIZE     = (size_t)1 << 30;
+
+/* when splitting, each block size of the input is split into steps of
+ * SPLIT_STEP characters, or longer ones so that there are no more than
+ * MAX_SPLIT_STEPS, and blocks end after whichever steps make the estimated
+ * bits of the blocks the fewest. Besides its codes and code lengths, every
+ * block costs SPLIT_BLOCK_BITS: its two sizes, type byte and stream table,
+ * and its entry in the index */
+const size_t SPLIT_STEP       = 1 << 14;
+const int    MAX_SPLIT_STEPS  = 64;
+const int    SPLIT_BLOCK_BITS = 8 * (4 * sizeof(uint) + 1 + sizeof(unsigned long long)) + 4;
+
+// encodeText makes sure there is room in its output this many characters at a time
+const size_t ENCODE_CHUNK = 1 << 16;
+
+/* a block's characters can be split round robin into up to MAX_STREAMS
+ * streams, encoded one after the other, which the decoder reads side by side */
+const int MAX_STREAMS = 8;
+
+/* with more than one thread, up to this many blocks per thread are compressed
+ * or written while the next are read */
+const int BLOCKS_PER_THREAD = 2;
+const int MAX_THREADS       = 256;
+
+// the binary file is written through a buffer this big, so it is written in large pieces
+const size_t OUTPUT_BUFFER = 1 << 20;
+
+/* an adaptive binary file starts with these 4 bytes instead; it is written in
+ * chunks of at most ADAPTIVE_CHUNK characters, each written out as soon as it
+ * is coded. Its codes are rebuilt no more often than every MIN_REBUILD_INTERVAL
+ * characters, as there are too few to count in between, and at most every
+ * MAX_REBUILD_INTERVAL, so that the counts they are built from cannot overflow */
+const char   ADAPTIVE_MAGIC[4]    = { 'H', 'U', 'F', 'A' };
+const size_t ADAPTIVE_CHUNK       = 1 << 16;
+const size_t MIN_REBUILD_INTERVAL = 1 << 10;
+const size_t MAX_REBUILD_INTERVAL = 1 << 26;
+
+/* a dictionary file, which holds codes trained on sample text, starts with
+ * DICT_MAGIC, and a message compressed with those codes starts with
+ * MESSAGE_MAGIC followed by the dictionary's ID instead of the codes */
+const char DICT_MAGIC[4]    = { 'H', 'U', 'F', 'D' };
+const char MESSAGE_MAGIC[4] = { 'H', 'U', 'F', 'M' };
+
+// the stages of compression timed for --stats
+const int READ_STAGE   = 0;
+const int COUNT_STAGE  = 1;
+const int TREE_STAGE   = 2;
+const int CODES_STAGE  = 3;
+const int ENCODE_STAGE = 4;
+const int WRITE_STAGE  = 5;
+const int NCOMPRESS_STAGES = 6;
+const char * const COMPRESS_STAGES[NCOMPRESS_STAGES] =
+    { "getContents", "getCFreqs", "createHuffTree", "genHuffCodes", "encodeText", "writeToFile" };
+
 /* structure used to build character-frequency database */
 struct cfreq
 {
-    char c;
+    unsigned short c; // a character, or a symbol of a larger alphabet
     int freq;
 };
 
-/* structure used to hold the huffman codes per character */
+/* structure used to hold the huffman codes per character; the code is
+ * stored in the low len bits, first bit of the code most significant */
 struct huffcode
 {
-    char c;
-    string code;
+    unsigned short c;
+    unsigned long long code;
+    int  len;
+};
+
+/* structure used to look up a character's code directly by its value */
+struct encodeEntry
+{
+    uint code;
+    uint len;
+};
+
+/* structure used to hold how hard the match finder looks for matches at
+ * each LZ level */
+struct lzlevel
+{
+    int  chain;      // earlier places with the same hash tried at most
+    uint good;       // looking one place ahead of a match this long, try a quarter as many
+    uint nice;       // a match this long is taken without trying any more
+    bool lazy;       // a match is put off if the next one along is longer
+};
+
+const lzlevel LZ_LEVELS[MAX_LZ_LEVEL + 1] =
+{
+    { 0, 0, 0, false },
+    { 4, 4, 8, false }, { 8, 4, 16, false }, { 16, 4, 32, false },
+    { 16, 4, 32, true }, { 32, 8, 64, true }, { 64, 8, 128, true },
+    { 128, 16, MAX_MATCH, true }, { 512, 32, MAX_MATCH, true }, { 1024, 32, MAX_MATCH, true }
+};
+
+/* structure used to hold the options each compression level chooses; every
+ * level writes the same format, so any of them can be extracted the same way */
+struct hufflevel
+{
+    bool sampled;    // codes are built from a sample of each block, and long
+                     // codes leave room for the characters it missed
+    int  lzLevel;
+    bool contexts;
+    bool split;
+    int  maxCodeLen;
+};
+
+const hufflevel LEVELS[MAX_LEVEL] =
+{
+    { true, 0, false, false, MAX_CODE_LEN },
+    { false, 0, false, false, DEFAULT_MAX_CODE_LEN },
+    { false, 1, false, false, DEFAULT_MAX_CODE_LEN },
+    { false, 3, false, false, DEFAULT_MAX_CODE_LEN },
+    { false, 5, false, false, DEFAULT_MAX_CODE_LEN },
+    { false, DEFAULT_LZ_LEVEL, false, false, DEFAULT_MAX_CODE_LEN },
+    { false, DEFAULT_LZ_LEVEL, true, true, DEFAULT_MAX_CODE_LEN },
+    { false, 8, true, true, MAX_CODE_LEN },
+    { false, MAX_LZ_LEVEL, true, true, MAX_CODE_LEN }
+};
+
+/* structure used to hold the choices made when compressing each block */
+struct huffoptions
+{
+    int  maxCodeLen; // no code is longer than this many bits
+    int  nstreams;   // each block is split into this many streams
+    bool contexts;   // the character before each one may choose its table
+    int  lzLevel;    // how hard to look for matches, 0 for none
+    size_t window;   // how far back a match may be
+    bool split;      // blocks end where the characters change, not every block size
+    bool sampled;    // the characters are counted in a sample of each block, not all of it
+};
+
+/* structure used to hold the blocks a piece of the input was split into, as
+ * they are handed out one at a time */
+struct blocksplitter
+{
+    const unsigned char * chunk;   // the characters that were split
+    vector <size_t> lengths;       // the length of each block, in order
+    size_t next;                   // the next block to hand out
+    size_t offset;                 // where it starts in the chunk
+    vector <uint> sums;            // the counts of every character before each step
+    vector <double> best;          // the fewest bits for the steps up to each one,
+    vector <int> from;             // and the step the last block of them starts at
+};
+
+/* structure used to hold the memory a block is compressed in, so that it is
+ * reused from one block to the next instead of being allocated for each */
+struct blockscratch
+{
+    vector <cfreq> cfreqs;
+    vector <huffcode> codes;
+    vector <uint> streamSizes;
+    vector <unsigned char> stream; // one stream's characters, when there are several
+    hufftree tree;
+    // for contexts, the counts of each character after each other one
+    vector <uint> pairs;
+    vector <unsigned char> pairChars;  // the characters seen after each context,
+    vector <uint> pairCounts;          // and how often, context by context
+    unsigned char contextTable[256];   // the table each context is coded with
+    vector <cfreq> tableFreqs;
+    vector <huffcode> tableCodes[MAX_CONTEXT_TABLES];
+    encodeEntry contextCodes[MAX_CONTEXT_TABLES][256];
+    // for LZ, the last place with each hash and the one before each place
+    vector <int> head;
+    vector <int> prev;
+    vector <unsigned short> lzSymbols; // a character, or 256 + a length code, for each step
+    vector <uint> lzMatches;           // the length and distance of each match
+    vector <huffcode> litlenCodes;
+    vector <huffcode> distCodes;
+    encodeEntry litlenTable[LITLEN_SYMBOLS];
+    encodeEntry distTable[DIST_CODES];
+    unsigned long long codeBits;       // bits the block takes with the tables chosen
+    vector <huffcode> repeatCodes;     // the table of an earlier block, to repeat
+};
+
+/* structure used to hand the table a block may repeat on from each block of
+ * a file to the next, in order, while the blocks are compressed at once; each
+ * block takes one turn, in takeTurn, and ends it in endTurn. A table built
+ * from a sample is handed on before its block is coded, and is only known to
+ * hold once checkTable has been called for it */
+struct repeatchain
+{
+    mutex lock;
+    condition_variable turnEnded;
+    unsigned long long turn;  // the block whose turn it is
+    vector <huffcode> codes;  // the table of the last block to have one of its own
+    int age;                  // blocks since that one
+    unsigned long long owner; // that block
+    bool unchecked;           // its block has not been coded with it yet
+    bool failed;              // its block was stored instead, so it can not be repeated
+};
+
+/* structure used to hold one block while it is being compressed */
+struct blockjob
+{
+    const unsigned char * contents;
+    size_t n;
+    unsigned long long number;     // the block's place in the file
+    vector <unsigned char> buffer; // holds the block when the input is not mapped
+    bitwriter header;
+    bitwriter encodedText;
+    blockscratch scratch;
+    huffstats stats;               // figures for this block, when --stats is given
+};
+
+/* structure used to index the blocks of the binary file, so that any block
+ * can be found without decoding the ones before it */
+struct blockindex
+{
+    unsigned long long offset; // where the block starts in the binary file
+    uint sizeofBlock;          // characters in the block
+    uint sizeofText;           // bytes of code lengths and encoded text
+};
+
+/* structure used to hold what the writer thread keeps from one block to the
+ * next as it writes them out in order */
+struct blockwriter
+{
+    ostream * out;
+    inputfile * in;                // told when blocks are written, so their pages can go
+    vector <blockindex> index;
+    unsigned long long offset;     // where the next block starts in the binary file
+    unsigned long long sizeofFile; // characters written so far
+    huffstats * stats;
+    atomic <bool> failed;
 };
 
 /* function protoypes */
-string getContents(string infilename);
-vector <cfreq> getCFreqs(string &contents);
+void   initOptions(huffoptions &opts, int maxCodeLen = DEFAULT_MAX_CODE_LEN, int nstreams = 1,
+                   bool contexts = false, int lzLevel = 0, size_t window = DEFAULT_WINDOW,
+                   bool split = false, bool sampled = false);
+void   initLevel(huffoptions &opts, int level, int nstreams = 1);
+void   compressBlock(const unsigned char * contents, size_t n, const huffoptions &opts,
+                     bitwriter &header, bitwriter &encodedText, blockscratch &scratch,
+                     repeatchain &chain, unsigned long long k, huffstats * stats = NULL);
+unsigned long long repeatedBits(vector <cfreq> &cfreqs, vector <huffcode> &codes);
+double leastBits(vector <cfreq> &cfreqs, size_t n);
+void   initChain(repeatchain &chain);
+void   takeTurn(repeatchain &chain, unsigned long long k, vector <huffcode> &codes);
+void   endTurn(repeatchain &chain, const vector <huffcode> * codes, bool unchecked = false);
+bool   tableHolds(repeatchain &chain);
+void   checkTable(repeatchain &chain, unsigned long long k, bool holds);
+size_t sampleCounts(const unsigned char * contents, size_t n, unsigned long long counts[256]);
+bool   worthCoding(const unsigned long long counts[256], size_t sampled);
+void   sampledCFreqs(const unsigned long long counts[256], vector <cfreq> &cfreqs);
+void   storeBlock(const unsigned char * contents, size_t n, bitwriter &header,
+                  bitwriter &encodedText, blockscratch &scratch, huffstats * stats);
+void   readJob(inputfile * in, blockjob * job, size_t blockSize, blocksplitter * splitter,
+               bool withStats);
+void   initSplitter(blocksplitter &splitter);
+bool   splitContents(inputfile &in, size_t blockSize, blocksplitter &splitter,
+                     const unsigned char * &block, size_t &n);
+void   splitBlocks(const unsigned char * contents, size_t n, blocksplitter &splitter);
+double splitBits(const uint * before, const uint * after);
+void   compressJob(blockjob * job, const huffoptions * opts, repeatchain * chain,
+                   bool withStats);
+void   writeJob(blockwriter * w, blockjob * job, future <void> * compressed);
+void   getCFreqs(const unsigned char * contents, size_t n, vector <cfreq> &cfreqs,
+                 int nthreads = 1);
+void   countBytes(const unsigned char * bytes, size_t n, unsigned long long counts[256]);
+void   countBytesParallel(const unsigned char * bytes, size_t n,
+                          unsigned long long counts[256], int nthreads);
 bool   compareByFreq(const cfreq &a, const cfreq &b);
-vector <node *> makeForest(vector <cfreq> cfreqs);
-node * createHuffTree(vector <node *> forest);
-node * findSmallest(vector <node *> forest, int &pos);
-void   printForest(vector <node *> forest);
-void   genHuffCodes(node * huffTree, string code, vector<huffcode> &codes);
-string encodeText(string &contents, vector <huffcode> codes);
-void   flatten(node * huffTree, string &flatTree);
-void   writeToFile(string outfilename, string flatTree, string encodedText);
-vector <uint> splitBinary(string binary);
-uint    toDecimal(string binstr);
-
-/* this function will build a huffman tree which can be used to create the
+void   makeForest(const vector <cfreq> &cfreqs, hufftree &tree);
+bool   compareNodesByFreq(const node &a, const node &b);
+int    createHuffTree(hufftree &tree);
+int    takeSmallest(hufftree &tree, int nleaves, int &nextLeaf, int &nextMerged);
+void   printForest(hufftree &tree);
+void   genHuffCodes(hufftree &tree, int n, unsigned long long code, int len,
+                    vector<huffcode> &codes);
+void   buildEncodeTable(vector <huffcode> &codes, encodeEntry table[], int nsymbols = 256);
+void   encodeText(const unsigned char * contents, size_t n, vector <huffcode> &codes,
+                  bitwriter &encodedText);
+void   encodeWithTable(const unsigned char * contents, size_t n, const encodeEntry table[256],
+                       int longest, bitwriter &encodedText);
+void   encodeStreams(const unsigned char * contents, size_t n, vector <huffcode> &codes,
+                     int nstreams, bitwriter &encodedText, vector <uint> &sizes,
+                     vector <unsigned char> &stream);
+void   limitCodeLengths(const vector <cfreq> &cfreqs, vector <huffcode> &codes, int maxLen);
+bool   compareByLength(const huffcode &a, const huffcode &b);
+void   canonicalCodes(vector <huffcode> &codes);
+void   writeCodeLengths(vector <huffcode> &codes, bitwriter &header, int nsymbols = 256);
+void   writeStreamTable(vector <uint> &sizes, bitwriter &header);
+void   recordCodes(huffstats * stats, vector <cfreq> &cfreqs, vector <huffcode> &codes);
+bool   writeToFile(ostream &outfile, uint sizeofBlock, bitwriter &header,
+                   bitwriter &encodedText);
+bool   writeTrailer(ostream &outfile, vector <blockindex> &index,
+                    unsigned long long sizeofFile);
+void   huffCompressAdaptive(string infilename, string outfilename, int maxCodeLen,
+                            size_t rebuildInterval, huffstats * stats);
+int    encodeAdaptive(adaptivetree &tree, unsigned char c, bitwriter &encodedText);
+void   rebuildCodes(unsigned long long counts[256], int maxCodeLen, vector <cfreq> &cfreqs,
+                    hufftree &tree, vector <huffcode> &codes);
+void   buildCodes(vector <cfreq> &cfreqs, int maxCodeLen, hufftree &tree,
+                  vector <huffcode> &codes);
+unsigned long long codedBits(vector <cfreq> &cfreqs, vector <huffcode> &codes);
+int    buildContextTables(const unsigned char * contents, size_t n, int maxCodeLen,
+                          blockscratch &scratch, unsigned long long &fewestBits);
+void   countPairs(const unsigned char * contents, size_t n, vector <uint> &pairs);
+int    clusterContexts(blockscratch &scratch);
+void   tableCosts(const double hist[256], double cost[256]);
+double contextCost(blockscratch &scratch, const int start[257], int p, const double cost[256]);
+double tableBits(const double hist[256]);
+int    lengthBits(const int lens[], int nsymbols = 256);
+void   encodeContexts(const unsigned char * contents, size_t n, int nstreams,
+                      blockscratch &scratch, bitwriter &encodedText, vector <uint> &sizes);
+void   writeContextTables(blockscratch &scratch, int ntables, bitwriter &header);
+bool   buildLzTables(const unsigned char * contents, size_t n, const huffoptions &opts,
+                     blockscratch &scratch, unsigned long long &fewestBits);
+void   findMatches(const unsigned char * contents, size_t n, const huffoptions &opts,
+                   blockscratch &scratch);
+uint   longestMatch(const unsigned char * contents, size_t n, size_t i, size_t window,
+                    int chain, uint nice, blockscratch &scratch, uint &dist);
+uint   matchLength(const unsigned char * p, const unsigned char * q, uint most);
+uint   hashAt(const unsigned char * p);
+void   insertHash(const unsigned char * contents, size_t n, size_t i, blockscratch &scratch);
+int    highestBit(uint v);
+uint   lzBucket(uint v, int mbits, uint &extra, int &extraBits);
+uint   lzBucketBase(uint code, int mbits, int &extraBits);
+void   encodeLz(blockscratch &scratch, bitwriter &encodedText, vector <uint> &sizes);
+void   writeLzTables(blockscratch &scratch, bitwriter &header);
+
+/* this function will compress the input file block by block, building a
+ * huffman tree for each block which can be used to create its part of the
  * output binary file; the name of the ouput binary file can optionally be
- * provided, but will default to out.bin if no output filename is provided
+ * provided, but will default to out.bin if no output filename is provided,
+ * each block is compressed with the options given, no block will hold more
+ * than blockSize characters, and nthreads blocks are compressed at once; if
+ * stats is given, the time spent in each stage and the compression achieved
+ * are added to it. A file name of "-" reads standard input or writes
+ * standard output. Errors are reported on errors, and it returns false if
+ * the file could not be compressed
  */
-void huffCompress(string infilename, string outfilename = "out.bin")
+inline bool huffCompress(string infilename, string outfilename, const huffoptions &opts,
+                         size_t blockSize = DEFAULT_BLOCK_SIZE, int nthreads = 1,
+                         huffstats * stats = NULL, ostream &errors = cerr)
 {
-    // dump the file contents into a string
-    string infileContents = getContents(infilename);
-    // if empty string returned due to error opening file, cut this function short
-    if (infileContents == "")
-        return;
+    // open the file, it is read in place wherever it can be mapped into memory
+    inputfile infile;
+    // if file opening fails, print error and cut this function short
+    if (!openInput(infilename, infile))
+    {
+        errors << "Error. Could not open file '" << infilename << "'." << endl;
+        return false;
+    }
 
-    // build a sorted vector of characters and their frequencies
-    vector <cfreq> cfreqs = getCFreqs(infileContents);
-    sort(cfreqs.begin(), cfreqs.end(), compareByFreq);
-    /* use character-frequency database to build a vector of single node
-     * trees, or a forest */
-    vector <node *> forest = makeForest(cfreqs);
-    // merge the trees in the forest to make a single Huffman tree
-    node * huffTree = createHuffTree(forest);
-    
-    //print huffTree
-    //printTree(huffTree);
-    
-    // generate the prefix code for each character
-    string code = "";
-    vector <huffcode> codes;
-    genHuffCodes(huffTree, code, codes);
-    cout << endl;
-    for (int i = 0; i < (int)codes.size(); i++)
-        cout << codes[i].c << ": " << codes[i].code << endl;
-    
-    /* iterate through the file contents and piece together a new string
-     * containing the prefix codes for each individual character as it occurs */
-    string encodedText = encodeText(infileContents, codes);
+    /* create output file, if it already exists, and then overwrite its contents:
+     * this is done because its more portable than checking if the specified file already exists
+     * and writing to a new file with a similar name to protect the existing file's contents 
+     * (checking if a file exists is operating system independent, or requires additional libraries);
+     * it is written through a large buffer, and "-" writes to standard output instead */
+    ofstream outfile;
+    vector <char> outbuffer(OUTPUT_BUFFER);
+    if (outfilename != "-")
+    {
+        outfile.rdbuf() -> pubsetbuf(&outbuffer[0], outbuffer.size());
+        outfile.open(outfilename.c_str(), ios::binary | ios::trunc ); 
+        if(!outfile.is_open())
+        {
+            errors << "Error. Could not open file '" << outfilename << "'." << endl;
+            closeInput(infile);
+            return false;
+        }
+    }
+    ostream &out = outfilename != "-" ? (ostream &)outfile : cout;
+    out.write(HUFF_MAGIC, sizeof(HUFF_MAGIC));
 
-    // flatten huffman tree
-    string flatTree = "";
-    flatten(huffTree, flatTree);
-    
-    // write to the binary file
-    writeToFile(outfilename, flatTree, encodedText);
+    /* every block is compressed on its own, so the work is split into a
+     * pipeline: a reader thread reads blocks ahead, they are compressed on
+     * this thread or on the worker threads, and a writer thread writes them
+     * out in order as they finish, so that compressing never waits on the
+     * disk. The jobs are reused in turn, so memory use depends on the block
+     * size and the number of threads and not the file size */
+    threadpool reader, writer, pool;
+    startPool(reader, 1);
+    startPool(writer, 1);
+    if (nthreads > 1)
+        startPool(pool, nthreads);
+    size_t ahead  = nthreads;
+    size_t behind = nthreads > 1 ? nthreads * BLOCKS_PER_THREAD : 1;
+    size_t window = ahead + 1 + behind;
+    vector <blockjob> jobs(window);
+    vector < future <void> > readDone(window), compressDone(window), writeDone(window);
+    blockwriter w;
+    w.out = &out;
+    w.in = &infile;
+    w.offset = sizeof(HUFF_MAGIC);
+    w.sizeofFile = 0;
+    w.stats = stats;
+    w.failed = false;
+    /* the blocks are compressed at once but decide in order whether to repeat
+     * the table of the one before; the pool runs them in the order they are
+     * given, so a block only ever waits on one that is already running */
+    repeatchain chain;
+    initChain(chain);
+    // when splitting, the reader splits the input where the characters change
+    blocksplitter splitter;
+    initSplitter(splitter);
+    blocksplitter * split = opts.split ? &splitter : NULL;
+
+    for (size_t k = 0; k <= ahead; k++)
+        readDone[k] = submitTask(reader, bind(readJob, &infile, &jobs[k], blockSize, split,
+                                              stats != NULL));
+    for (unsigned long long k = 0; ; k++)
+    {
+        // compress the next block once it has been read
+        size_t slot = k % window;
+        blockjob &job = jobs[slot];
+        readDone[slot].get();
+        if (job.n == 0 || w.failed)
+            break;
+        job.number = k;
+        if (nthreads > 1)
+            compressDone[slot] = submitTask(pool, bind(compressJob, &job, &opts, &chain,
+                                                       stats != NULL));
+        else
+            compressJob(&job, &opts, &chain, stats != NULL);
+        writeDone[slot] = submitTask(writer, bind(writeJob, &w, &job, &compressDone[slot]));
+
+        // the reader gets the job of the oldest block once it has been written
+        size_t next = (k + ahead + 1) % window;
+        if (writeDone[next].valid())
+            writeDone[next].get();
+        readDone[next] = submitTask(reader, bind(readJob, &infile, &jobs[next], blockSize,
+                                                 split, stats != NULL));
+    }
+    // wait for the blocks read past the end, and for the last ones to be written
+    for (size_t i = 0; i < window; i++)
+    {
+        if (readDone[i].valid())
+            readDone[i].get();
+        if (writeDone[i].valid())
+            writeDone[i].get();
+    }
+    stopPool(reader);
+    stopPool(writer);
+    if (nthreads > 1)
+        stopPool(pool);
+
+    //if file contents are bad, print error
+    bool done = true;
+    if (infile.failed)
+    {
+        errors << "Error while reading file '" << infilename << "'." << endl;
+        done = false;
+    }
+    // the end of the file indexes the blocks and records how long the original was
+    if (w.failed || !writeTrailer(out, w.index, w.sizeofFile) || !out.flush())
+    {
+        errors << "Error while writing file '" << outfilename << "'." << endl;
+        done = false;
+    }
+    if (stats)
+        stats -> bytesOut += w.offset + sizeof(uint)
+                            + w.index.size() * (sizeof(unsigned long long) + 2 * sizeof(uint))
+                            + 2 * sizeof(unsigned long long);
+
+    // close the files
+    closeInput(infile);
+    if (outfilename != "-")
+        outfile.close();
+    return done;
 }
 
-/* this function will read the contents of an input file and dump them into
- * a single string with new line characters */
-string getContents(string infilename)
+/* this function will read the next block of the input into a job, as a task
+ * on the reader thread, leaving the job with no characters at the end of the
+ * input; with a splitter, the block is the next of those the input is split
+ * into. The pages of a mapped block are touched here, so that waiting for
+ * the disk happens on this thread and not while the block is compressed */
+inline void readJob(inputfile * in, blockjob * job, size_t blockSize, blocksplitter * splitter,
+                    bool withStats)
 {
-    // open the file
-    ifstream infile;
-    infile.open(infilename.c_str());
-    // if file opening fails, print error and return empty string
-    if (!infile.is_open())
+    huffstats * stats = withStats ? &job -> stats : NULL;
+    stagetimer timer = { 0, 0 };
+    if (stats)
+        initStats(job -> stats, COMPRESS_STAGES, NCOMPRESS_STAGES);
+    startStage(stats, timer);
+    bool more = splitter ? splitContents(*in, blockSize, *splitter, job -> contents, job -> n)
+                         : getContents(*in, blockSize, job -> contents, job -> n);
+    if (!more)
     {
-        cerr << "Error. Could not open file '" << infilename << "'." << endl;
-        return "";
+        job -> n = 0;
+        return;
     }
-
-    /* grab the file contents line by line, placing newline chars at the end
-     * of each line */
-    string str;
-    string contents;
-    while (getline(infile, str))
+    /* a block that was read rather than mapped keeps the buffer it was read
+     * into, or a copy of its part of it when the buffer was split */
+    if (in -> data == NULL && splitter)
     {
-        contents += str;
-        contents.push_back('\n');
+        job -> buffer.assign(job -> contents, job -> contents + job -> n);
+        job -> contents = &job -> buffer[0];
     }
-    /* push back the eof character which will be used to indicate the end of
-     * the data stream when rebuilding and reinflating the file */
-    contents.push_back('\0');
-    //if file contents are bad, print error and return empty string
-    if (infile.bad())
+    else if (in -> data == NULL)
+        job -> buffer.swap(in -> buffer);
+    else
+        prefetchContents(job -> contents, job -> n);
+    endStage(stats, READ_STAGE, timer);
+}
+
+/* this function will empty the splitter, so that the next block read splits
+ * more of the input */
+inline void initSplitter(blocksplitter &splitter)
+{
+    splitter.chunk = NULL;
+    splitter.lengths.clear();
+    splitter.next = 0;
+    splitter.offset = 0;
+}
+
+/* this function will point block at the next n characters of the input split
+ * where they change, returning false once there is nothing left to read; once
+ * the blocks split before are used up, up to blockSize more are read and split.
+ * The last of those blocks might go on past them, so unless it is all there
+ * is it is given back and split again with what follows */
+inline bool splitContents(inputfile &in, size_t blockSize, blocksplitter &splitter,
+                          const unsigned char * &block, size_t &n)
+{
+    if (splitter.next == splitter.lengths.size())
     {
-        cerr << "Error while reading file '" << infilename << "'." << endl;
-        infile.close();
-        return "";
+        if (!getContents(in, blockSize, splitter.chunk, n))
+            return false;
+        splitBlocks(splitter.chunk, n, splitter);
+        if (n == blockSize && splitter.lengths.size() > 1)
+        {
+            ungetContents(in, splitter.lengths.back());
+            splitter.lengths.pop_back();
+        }
     }
-    
-    // close the file
-    infile.close();
-    
-    // if file read successfully, return the its contents + an added EOF char
-    return contents;
+    n = splitter.lengths[splitter.next++];
+    block = splitter.chunk + splitter.offset;
+    splitter.offset += n;
+    return true;
 }
 
-/* this function will read a string containing a file's contents and count
- * the frequency of each unique character, returning a vector of structs
- * that contain each unique character and it's corresponding frequency */
-vector <cfreq> getCFreqs (string &contents)
+/* this function will split the n characters at contents into the blocks that
+ * take the fewest bits, as splitBits estimates them, ending each block after
+ * a whole number of steps: every way of splitting the steps up to each one is
+ * weighed by the fewest bits of the steps before where its last block starts */
+inline void splitBlocks(const unsigned char * contents, size_t n, blocksplitter &splitter)
 {
-    vector <cfreq> cfreqs;
-    /* iterate over the contents of the file character by character
-     * comparing it to existing database */
-    for (int i = 0; i < (int)contents.size(); i++)
+    size_t step = max(SPLIT_STEP, (n + MAX_SPLIT_STEPS - 1) / MAX_SPLIT_STEPS);
+    int nsteps = (n + step - 1) / step;
+    // the counts before each step, so that any run of steps is counted at once
+    vector <uint> &sums = splitter.sums;
+    sums.assign((nsteps + 1) * 256, 0);
+    for (int i = 0; i < nsteps; i++)
+    {
+        unsigned long long counts[256] = { 0 };
+        countBytes(contents + i * step, min(step, n - i * step), counts);
+        for (int c = 0; c < 256; c++)
+            sums[(i + 1) * 256 + c] = sums[i * 256 + c] + counts[c];
+    }
+
+    vector <double> &best = splitter.best;
+    vector <int> &from = splitter.from;
+    best.assign(nsteps + 1, 0);
+    from.assign(nsteps + 1, 0);
+    for (int j = 1; j <= nsteps; j++)
     {
-        bool inDB = false;
-        for (int j = 0; j < (int)cfreqs.size(); j++)
+        for (int i = 0; i < j; i++)
         {
-            /* if the character in the file is in the database then
-             * increase the frequency count of the character */
-            if (contents[i] == (cfreqs[j].c))
+            double bits = best[i] + splitBits(&sums[i * 256], &sums[j * 256]);
+            if (i == 0 || bits < best[j])
             {
-                cfreqs[j].freq++;
-                inDB = true;
-                break;
+                best[j] = bits;
+                from[j] = i;
             }
         }
-        /* if the character in the file is not in the database then
-         * create new cfreq to store the character and its frequency
-         * value of 1 in the database */
-        if (!inDB)
-        {
-            cfreq temp;
-            temp.c = contents[i];
-            temp.freq = 1;
-            cfreqs.push_back(temp);
-        }
     }
-    
-    // return the database of character frequencies
-    return cfreqs;
+
+    // walk back from the last step to where each block starts
+    splitter.lengths.clear();
+    for (int j = nsteps; j > 0; j = from[j])
+        splitter.lengths.push_back(min(j * step, n) - from[j] * step);
+    reverse(splitter.lengths.begin(), splitter.lengths.end());
+    splitter.next = 0;
+    splitter.offset = 0;
 }
 
-/* this function serves as a reference for comparing two cfreq structures
- * by std::algorithm::sort, which will sort by greatest frequency to
- * least */
-bool compareByFreq(const cfreq &a, const cfreq &b)
+/* this function will estimate the bits a block of the characters counted
+ * between two of the sums takes: their entropy, which codes of their own come
+ * close to, the code lengths in its header and what every block costs */
+inline double splitBits(const uint * before, const uint * after)
 {
-    return a.freq > b.freq;
+    int lens[256];
+    double total = 0;
+    double bits = 0;
+    for (int c = 0; c < 256; c++)
+    {
+        uint count = after[c] - before[c];
+        lens[c] = count > 0;
+        if (count > 0)
+        {
+            total += count;
+            bits -= count * log2((double)count);
+        }
+    }
+    return bits + total * log2(total) + lengthBits(lens) + SPLIT_BLOCK_BITS;
 }
 
-/* this function will use the data found in a character-frequency database
- * to create a forest of single-node trees in the form of a doubly-linked
- * list */
-vector <node *> makeForest(vector <cfreq> cfreqs)
+/* this function will write a job's block to the binary file once it has been
+ * compressed, as a task on the writer thread, which writes the blocks in the
+ * order they were read and indexes them as it goes */
+inline void writeJob(blockwriter * w, blockjob * job, future <void> * compressed)
 {
-    // vector to store a forest of single-node trees
-    vector <node *> forest;
-    // create and append single-node trees to the forest
-    for (int i = 0; i < (int)cfreqs.size(); i++)
+    if (compressed -> valid())
+        compressed -> get();
+    if (w -> failed)
+        return;
+    huffstats * stats = w -> stats ? &job -> stats : NULL;
+    stagetimer timer = { 0, 0 };
+    startStage(stats, timer);
+    if (!writeToFile(*w -> out, job -> n, job -> header, job -> encodedText))
+        w -> failed = true;
+    blockindex entry;
+    entry.offset = w -> offset;
+    entry.sizeofBlock = job -> n;
+    entry.sizeofText = job -> header.bytes.size() + job -> encodedText.bytes.size();
+    w -> index.push_back(entry);
+    w -> offset += 2 * sizeof(uint) + entry.sizeofText;
+    w -> sizeofFile += job -> n;
+    releaseContents(*w -> in, job -> contents + job -> n);
+    if (stats)
     {
-        node * newTree = createNode(cfreqs[i].freq, true);
-        newTree -> c   = cfreqs[i].c;
-        forest.push_back(newTree);
+        endStage(stats, WRITE_STAGE, timer);
+        mergeStats(*w -> stats, *stats);
     }
-        
-    // return the list of new single-node trees
-    return forest;
 }
 
-/* this function will merge all the trees in a forest two-by-two until there
- * is a single Huffman tree remaining, from which prefix codes for the characters
- * in the file contents can be generated */
-node * createHuffTree(vector <node *> forest)
+/* this function will compress one block of a job, as a task on a worker thread
+ * or directly when there is only one thread, timing it into the job's own
+ * stats if withStats is set */
+inline void compressJob(blockjob * job, const huffoptions * opts, repeatchain * chain,
+                        bool withStats)
 {
-    node * huffTree = new node;
-    
-    while (forest.size() != 0)
-    {
-        // trees to be merged together
-        node * tree1 = new node;
-        node * tree2 = new node;
-        node * mergedTree = new node;
-
-        // tracking variables
-        int smallTreePos = 0;
-
-        // find smallest tree in the forest
-        node * smallestTree = findSmallest(forest, smallTreePos);
-        
-        //printForest(forest);
-       
-        // assign the smallest tree's values to tree1
-        tree1 -> freq   = smallestTree -> freq;
-        tree1 -> c      = smallestTree -> c;
-        tree1 -> isLeaf = smallestTree -> isLeaf;
-        tree1 -> left   = smallestTree -> left;
-        tree1 -> right  = smallestTree -> right;
-        //cout << "populated tree1:" << tree1 << " -> freq:" << tree1 -> freq << " -> c:" << tree1 -> c << endl;
-        //cout << "tree1 comes from:" << smallestTree << endl;
-
-        // delete the smallest tree from forest and start over with tree2
-        //cout << "deleting:" << smallestTree << endl;
-        forest.erase(forest.begin() + smallTreePos);
-
-        // reset relevant variables
-        smallTreePos = 0;
-        
-        // find second smallest tree in forest
-        smallestTree = findSmallest(forest, smallTreePos);
-
-        //printForest(forest);
-
-        // assign this smallest tree to tree2
-        tree2 -> freq   = smallestTree -> freq;
-        tree2 -> c      = smallestTree -> c;
-        tree2 -> isLeaf = smallestTree -> isLeaf;
-        tree2 -> left   = smallestTree -> left;
-        tree2 -> right  = smallestTree -> right;
-        //cout << "populated tree2:" << tree2 << " -> freq:" << tree2 -> freq << " -> c:" << tree2 -> c << endl;
-        //cout << "tree2 comes from:" << smallestTree << endl;
-
-        // delete the smallest tree from the forest
-        //cout << "deleting:" << smallestTree << endl;
-        forest.erase(forest.begin() + smallTreePos);
-
-        //printForest(forest);
-                
-        // merge tree1 and tree2
-        mergedTree = mergeTree(tree1, tree2);
-        //cout << "merged tree1 and tree2" << endl;
-        //cout << "mergedtree:" << mergedTree << " -> freq:" << mergedTree -> freq << endl;
-        // add merged tree back into the forest
-        forest.push_back(mergedTree);
-        //cout << "added mergedTree back into the forest" << endl;
-
-        //printForest(forest);
-         
-        // repeat until only one tree left in the forest
-        if (forest.size() == 1)
-        {
-            huffTree = forest[0];
-            break;
-        }
-    }
+    compressBlock(job -> contents, job -> n, *opts, job -> header, job -> encodedText,
+                  job -> scratch, *chain, job -> number, withStats ? &job -> stats : NULL);
+}
 
-    // return newly created huffman tree
-    return huffTree;
+/* this function will set the options huffCompress compresses each block with */
+inline void initOptions(huffoptions &opts, int maxCodeLen, int nstreams, bool contexts,
+                        int lzLevel, size_t window, bool split, bool sampled)
+{
+    opts.maxCodeLen = maxCodeLen;
+    opts.nstreams = nstreams;
+    opts.contexts = contexts;
+    opts.lzLevel = lzLevel;
+    opts.window = window;
+    opts.split = split;
+    opts.sampled = sampled;
 }
 
-/* this function will return the smallest tree in a forest and its position in vector */
-node * findSmallest (vector <node *> forest, int &pos)
+/* this function will set the options of one of the compression levels, from
+ * 1 to MAX_LEVEL, with nstreams streams to each block */
+inline void initLevel(huffoptions &opts, int level, int nstreams)
 {
-    node * smallest;
-    int compareFreq = INT_MAX;
+    const hufflevel &l = LEVELS[level - 1];
+    initOptions(opts, l.maxCodeLen, nstreams, l.contexts, l.lzLevel, DEFAULT_WINDOW, l.split,
+                l.sampled);
+}
 
-    for (int i = 0; i < (int)forest.size(); i++)
+/* this function will build the codes for one block of the file, and write the
+ * block type, the length of each code and the size of each stream into the
+ * header and the encoded block into encodedText, working in the memory of
+ * scratch; a block that coding would not shrink by MIN_SAVING percent is
+ * stored instead, one of a single character repeated is written as that
+ * character, and one whose characters cost no more with the table of an
+ * earlier block than with their own repeats that table; with sampled set, a
+ * block without contexts or LZ is coded from the counts of a sample of it,
+ * and only repeats a table that has been found to hold for its own block.
+ * The block is the kth of those taking turns at the table in chain. Each
+ * stage is timed into stats if given */
+inline void compressBlock(const unsigned char * contents, size_t n, const huffoptions &opts,
+                          bitwriter &header, bitwriter &encodedText, blockscratch &scratch,
+                          repeatchain &chain, unsigned long long k, huffstats * stats)
+{
+    stagetimer timer = { 0, 0 };
+    startStage(stats, timer);
+    vector <huffcode> &repeatCodes = scratch.repeatCodes;
+    vector <cfreq> &cfreqs = scratch.cfreqs;
+    /* no code beats the entropy of the characters, so a block whose sample
+     * shows too little to save is stored straight away; matches and contexts
+     * can do better than that, so they are always tried. Without them, the
+     * codes may be built from the counts of the sample alone */
+    bool early = opts.lzLevel == 0 && !opts.contexts;
+    bool sampled = early && opts.sampled;
+    if (early)
+    {
+        unsigned long long counts[256] = { 0 };
+        size_t m = sampleCounts(contents, n, counts);
+        if (!worthCoding(counts, m))
+        {
+            takeTurn(chain, k, repeatCodes);
+            endTurn(chain, NULL);
+            storeBlock(contents, n, header, encodedText, scratch, stats);
+            endStage(stats, ENCODE_STAGE, timer);
+            return;
+        }
+        if (sampled)
+        {
+            for (int c = 0; c < 256; c++)
+                counts[c] = counts[c] * n / m;
+            sampledCFreqs(counts, cfreqs);
+        }
+    }
+    // build a sorted vector of characters and their frequencies
+    if (!sampled)
+        getCFreqs(contents, n, cfreqs);
+    sort(cfreqs.begin(), cfreqs.end(), compareByFreq);
+    endStage(stats, COUNT_STAGE, timer);
+    if (cfreqs.size() == 1)
     {
-        if ((forest[i] -> freq) < compareFreq)
+        takeTurn(chain, k, repeatCodes);
+        endTurn(chain, NULL);
+        initWriter(encodedText);
+        initWriter(header);
+        putBits(header, RLE_BLOCK, 8);
+        putBits(header, cfreqs[0].c, 8);
+        if (stats)
         {
-            compareFreq = forest[i] -> freq;
-            smallest = forest[i];
-            pos = i;
+            stats -> bytesIn = n;
+            stats -> blocks = 1;
+            scratch.codes.clear();
+            recordCodes(stats, cfreqs, scratch.codes);
         }
+        return;
     }
 
-    //cout << "smallest tree in forest is: " << smallest << " -> freq:" << smallest -> freq << " -> c:" << smallest -> c << endl;
-    return smallest;
-}
+    /* the blocks take turns, in order, at the table of the last block to
+     * have one of its own, as each can only tell what it is once the block
+     * before has decided. Without contexts or LZ the turn is taken before
+     * the tree is built, and a block that costs no more with that table than
+     * the entropy of its characters, and the lengths of codes of its own,
+     * repeats it without building a tree at all */
+    unsigned long long repeatBits = ULLONG_MAX;
+    if (early)
+    {
+        takeTurn(chain, k, repeatCodes);
+        repeatBits = repeatedBits(cfreqs, repeatCodes);
+    }
+    bool repeat = repeatBits != ULLONG_MAX && repeatBits <= leastBits(cfreqs, n);
+    /* from a sample, the choice is made here, so that only a block that will
+     * repeat the table has to wait for it to be checked */
+    if (sampled && !(repeat && tableHolds(chain)))
+    {
+        repeat = false;
+        repeatBits = ULLONG_MAX;
+    }
+    vector <huffcode> &codes = scratch.codes;
+    unsigned long long bits = repeatBits;
+    int ntables = 1;
+    bool lz = false;
+    if (!repeat)
+    {
+        /* use character-frequency database to build a forest of single node
+         * trees, all held in one array so the tree needs no allocations */
+        hufftree &huffTree = scratch.tree;
+        makeForest(cfreqs, huffTree);
+        // merge the trees in the forest to make a single Huffman tree
+        createHuffTree(huffTree);
+        endStage(stats, TREE_STAGE, timer);
 
-/* this is a function mainly for debugging purposes that will
- * print a vector of nodes (or a forest) in a relatively readable format */
-void printForest(vector <node *> forest)
-{
-    // find size of forest
-    cout << (int)forest.size() << endl;
+        //print huffTree
+        //printTree(huffTree, huffTree.root);
 
-    // print forest
-    for (int i = 0; i < forest.size(); i++)
-    {
-        cout << "addr = " << forest[i];
-        if (!(forest[i] -> isLeaf))
+        // generate the prefix code for each character
+        codes.clear();
+        genHuffCodes(huffTree, huffTree.root, 0, 0, codes);
+        /* only the length of each code is kept; codes that are too long are
+         * shortened, and the codes themselves are reassigned in canonical order
+         * so that the lengths are all the decoder needs to rebuild them */
+        limitCodeLengths(cfreqs, codes, opts.maxCodeLen);
+        canonicalCodes(codes);
+
+        /* with contexts, a table for each group of contexts is built as well,
+         * and with LZ the matches are found and tables built for them; the
+         * block is coded whichever way takes the fewest bits, repeating the
+         * table included */
+        bits = codedBits(cfreqs, codes);
+        if (opts.contexts)
+            ntables = buildContextTables(contents, n, opts.maxCodeLen, scratch, bits);
+        lz = opts.lzLevel > 0 && buildLzTables(contents, n, opts, scratch, bits);
+        if (!early)
         {
-            cout << " left = "  << forest[i] -> left;
-            cout << " right = " << forest[i] -> right;
+            takeTurn(chain, k, repeatCodes);
+            repeatBits = repeatedBits(cfreqs, repeatCodes);
+        }
+        if (repeatBits <= bits)
+        {
+            repeat = true;
+            bits = repeatBits;
+            ntables = 1;
+            lz = false;
         }
-        else
-            cout << " char = "  << forest[i] -> c;
-        cout << " freq = " << forest[i] -> freq;
-        cout << "   <-->   ";
-        
     }
-    cout << "\n" << endl;
-}
+    endStage(stats, CODES_STAGE, timer);
 
-/* this function will recurse through the tree to generate variable
- * length prefix codes for each character in the tree */
-void genHuffCodes(node * huffTree, string code, vector<huffcode> &codes)
-{
-    // append a 0 to the code if we go left in the tree
-    if (huffTree -> left)
+    /* the most the block can take coded, with the type byte, the stream table
+     * and each stream and the header padded to a whole byte */
+    unsigned long long most = bits + 8 + 4 + 32 * (opts.nstreams - 1) + 7 * (opts.nstreams + 1);
+    bool stored = most * 100 > 8ULL * n * (100 - MIN_SAVING);
+    /* the next block can go on as soon as it knows whether this one has a
+     * table of its own; codes built from a sample are only known to be short
+     * enough once the block has been coded with them, so until then no block
+     * repeats them */
+    bool ownTable = !stored && !repeat && !lz && ntables == 1;
+    endTurn(chain, ownTable ? &codes : NULL, sampled && ownTable);
+    if (stored)
     {
-        code.push_back('0');
-        genHuffCodes(huffTree -> left, code, codes);
-        code.erase(code.begin()+code.length()-1);
+        storeBlock(contents, n, header, encodedText, scratch, stats);
+        endStage(stats, ENCODE_STAGE, timer);
+        return;
     }
-    // append a 1 to the code if we go left in the tree
-    if (huffTree -> right)
+    
+    /* iterate through the block and pack the prefix codes for each
+     * individual character into a stream of bits as it occurs; no prefix code
+     * averages more than 8 bits per character, so reserve the block size */
+    initWriter(encodedText, n);
+    vector <uint> &streamSizes = scratch.streamSizes;
+    initWriter(header);
+    if (lz)
     {
-        code.push_back('1');
-        genHuffCodes(huffTree -> right, code, codes);
-        code.erase(code.begin()+code.length()-1);
+        encodeLz(scratch, encodedText, streamSizes);
+        putBits(header, LZ_BLOCK, 8);
+        writeLzTables(scratch, header);
     }
-    /* if a leaf node is encountered, assign the code and the encountered
-     * character to a huffcode structure, and add it to the vector */
-    if (huffTree -> isLeaf)
+    else if (ntables > 1)
     {
-        huffcode ccode;
-        ccode.c = huffTree -> c;
-        ccode.code = code;
-        codes.push_back(ccode);
+        encodeContexts(contents, n, opts.nstreams, scratch, encodedText, streamSizes);
+        putBits(header, CONTEXT_BLOCK, 8);
+        writeContextTables(scratch, ntables, header);
+    }
+    else if (repeat)
+    {
+        encodeStreams(contents, n, repeatCodes, opts.nstreams, encodedText, streamSizes,
+                      scratch.stream);
+        putBits(header, REPEAT_BLOCK, 8);
+    }
+    else
+    {
+        encodeStreams(contents, n, codes, opts.nstreams, encodedText, streamSizes,
+                      scratch.stream);
+        putBits(header, HUFFMAN_BLOCK, 8);
+        writeCodeLengths(codes, header);
     }
-}
 
-/* this function will iterate through the plain-text contents and translate it using
- * the huffman codes that were generated previously */
-string encodeText(string &contents, vector <huffcode> codes)
-{
-    string encodedText = "";
-    for (int i = 0; i < (int)contents.length(); i++)
+    /* the header holds the block type and the length of each code, followed
+     * by where each stream starts */
+    writeStreamTable(streamSizes, header);
+    if (sampled)
     {
-        for (int j = 0; j < (int)codes.size(); j++)
+        /* a sample can miss what the rest of the block holds, so a block it
+         * gave codes that do not save enough is stored after all */
+        unsigned long long written = bitsWritten(header) + bitsWritten(encodedText);
+        bool worse = written * 100 > 8ULL * n * (100 - MIN_SAVING);
+        if (ownTable)
+            checkTable(chain, k, !worse);
+        if (worse)
         {
-            /* if current character matches a character in the database
-             * add the code associated with the character to the end of the 
-             * encoded text string */
-            if (contents[i] == codes[j].c)
-            {
-                encodedText += codes[j].code;
-                break;
-            }
+            storeBlock(contents, n, header, encodedText, scratch, stats);
+            endStage(stats, ENCODE_STAGE, timer);
+            return;
+        }
+    }
+    endStage(stats, ENCODE_STAGE, timer);
+    if (stats)
+    {
+        // the figures are for the characters the block really holds
+        if (sampled)
+            getCFreqs(contents, n, cfreqs);
+        stats -> bytesIn = n;
+        stats -> blocks = 1;
+        recordCodes(stats, cfreqs, repeat ? repeatCodes : codes);
+        if (lz)
+        {
+            stats -> codeBits = scratch.codeBits;
+            stats -> maxCodeLen = 0;
+            for (size_t i = 0; i < scratch.litlenCodes.size(); i++)
+                stats -> maxCodeLen = max(stats -> maxCodeLen, scratch.litlenCodes[i].len);
+            for (size_t i = 0; i < scratch.distCodes.size(); i++)
+                stats -> maxCodeLen = max(stats -> maxCodeLen, scratch.distCodes[i].len);
+        }
+        else if (ntables > 1)
+        {
+            stats -> codeBits = scratch.codeBits;
+            stats -> maxCodeLen = 0;
+            for (int t = 0; t < ntables; t++)
+                for (size_t i = 0; i < scratch.tableCodes[t].size(); i++)
+                    stats -> maxCodeLen = max(stats -> maxCodeLen, scratch.tableCodes[t][i].len);
         }
     }
-
-    return encodedText;
 }
 
-/* this function will take a huffman tree and create a "flattened" string
- * representation of it which can be used to create the header of the binary file */
-void flatten(node * huffTree, string &flatTree)
+/* this function will find the bits the symbols counted in cfreqs take with
+ * the codes of an earlier block, or ULLONG_MAX if there are none or some
+ * symbol has no code among them */
+inline unsigned long long repeatedBits(vector <cfreq> &cfreqs, vector <huffcode> &codes)
 {
-    if (!(huffTree -> isLeaf))
+    if (codes.empty())
+        return ULLONG_MAX;
+    int lens[256] = { 0 };
+    for (size_t i = 0; i < codes.size(); i++)
+        lens[codes[i].c] = codes[i].len;
+    unsigned long long bits = 0;
+    for (size_t i = 0; i < cfreqs.size(); i++)
     {
-        flatTree += '0';
-        flatten(huffTree -> left, flatTree);
-        flatten(huffTree -> right, flatTree);
+        if (lens[cfreqs[i].c] == 0)
+            return ULLONG_MAX;
+        bits += (unsigned long long)cfreqs[i].freq * lens[cfreqs[i].c];
     }
-    if (huffTree -> isLeaf)
+    return bits;
+}
+
+/* this function will find the fewest bits the n symbols counted in cfreqs
+ * could take with codes of their own: no codes beat their entropy, and the
+ * header gives a length for each of them whatever the lengths are */
+inline double leastBits(vector <cfreq> &cfreqs, size_t n)
+{
+    int lens[256] = { 0 };
+    double bits = 0;
+    for (size_t i = 0; i < cfreqs.size(); i++)
     {
-        flatTree += '1';
-        int charValue = huffTree -> c;
-        // convert character to binary
-        string binary = bitset<8>(charValue).to_string();
-        flatTree += binary;
+        lens[cfreqs[i].c] = 1;
+        bits += cfreqs[i].freq * log2((double)n / cfreqs[i].freq);
     }
+    return bits + lengthBits(lens);
 }
 
-/* this function will build the header of the file and write it and the encoded text
- * to the binary file */
-void writeToFile(string outfilename, string flatTree, string encodedText)
+/* this function will start the chain of tables afresh, for a new file */
+inline void initChain(repeatchain &chain)
+{
+    chain.turn = 0;
+    chain.codes.clear();
+    chain.age = 0;
+    chain.owner = 0;
+    chain.unchecked = false;
+    chain.failed = false;
+}
+
+/* this function will wait for the kth block's turn at the chain, then copy
+ * the table it may repeat into codes, leaving codes empty when there is none,
+ * it was written more than MAX_REPEATS blocks back, or its block was stored;
+ * the turn lasts until endTurn is called */
+inline void takeTurn(repeatchain &chain, unsigned long long k, vector <huffcode> &codes)
+{
+    unique_lock <mutex> guard(chain.lock);
+    while (chain.turn != k)
+        chain.turnEnded.wait(guard);
+    if (chain.age < MAX_REPEATS && !chain.failed)
+        codes = chain.codes;
+    else
+        codes.clear();
+}
+
+/* this function will end a block's turn at the chain, handing on its codes if
+ * it is written with a table of its own, or NULL if not; unchecked is set
+ * when the codes were built from a sample, until checkTable is called */
+inline void endTurn(repeatchain &chain, const vector <huffcode> * codes, bool unchecked)
 {
-    /* create output file, if it already exists, and then overwrite its contents:
-     * this is done because its more portable than checking if the specified file already exists
-     * and writing to a new file with a similar name to protect the existing file's contents 
-     * (checking if a file exists is operating system independent, or requires additional libraries) */
-    ofstream outfile;
-    outfile.open(outfilename.c_str(), ios::binary | ios::trunc ); 
-    if(outfile.is_open())
-        cout << "Successfully opened " << outfilename << endl;
-    if(!outfile.is_open())
-        cout << "Failed to open " << outfilename << endl;
-    
-    // calculate size of header
-    int sizeofTree = 0; // size of tree in bits
-    for (int i = 0; i < (int)flatTree.length(); i++)
-        sizeofTree++;
-    // write integer to the file that contains size of header (tree)
-    outfile.write((char *)&sizeofTree, sizeof(sizeofTree));
-    cout << "bitsize of header: " << sizeofTree << endl;
-    //cout << "wrote 4 byte integer bitsize to file" << endl;
-    
-    // write the tree to file
-    vector <uint> treeInts = splitBinary(flatTree);
-    for (int i = 0; i < (int)treeInts.size(); i++)
     {
-        outfile.write((char *)&treeInts[i], sizeof(treeInts[i]));
-        //cout << "wrote " << hex << treeInts[i] << " to file" << endl;
+        lock_guard <mutex> guard(chain.lock);
+        if (codes)
+        {
+            chain.codes = *codes;
+            chain.age = 0;
+            chain.owner = chain.turn;
+            chain.unchecked = unchecked;
+            chain.failed = false;
+        }
+        else
+            chain.age++;
+        chain.turn++;
     }
-    cout << "wrote header to file" << endl;
+    chain.turnEnded.notify_all();
+}
 
-    // determine size of the encoded text
-    int sizeofText = 0;
-    for (int i = 0; i < (int)encodedText.length(); i++)
-        sizeofText++;
-    // write integer to the file that contains size of encoded text
-    outfile.write((char *)&sizeofText, sizeof(sizeofText));
-    cout << "\nbitsize of encoded text: " << sizeofText << endl;
-    //cout << "wrote 4 byte integer bitsize to file" << endl;
+/* this function will wait, during a block's turn, until the table it would
+ * repeat has been checked, returning whether it holds; only the first block
+ * to repeat a table built from a sample waits, while that table's block is
+ * being coded, and the blocks that do not repeat it never do */
+inline bool tableHolds(repeatchain &chain)
+{
+    unique_lock <mutex> guard(chain.lock);
+    while (chain.unchecked)
+        chain.turnEnded.wait(guard);
+    return !chain.failed;
+}
 
-    // write encoded text to the file
-    vector <uint> textInts = splitBinary(encodedText);
-    for (int i = 0; i < (int)textInts.size(); i++)
+/* this function will record whether the table the kth block built from a
+ * sample held once the block was coded with it, unless a later block has
+ * handed on a table of its own since */
+inline void checkTable(repeatchain &chain, unsigned long long k, bool holds)
+{
+    {
+        lock_guard <mutex> guard(chain.lock);
+        if (chain.owner == k && chain.unchecked)
+        {
+            chain.unchecked = false;
+            chain.failed = !holds;
+        }
+    }
+    chain.turnEnded.notify_all();
+}
+
+/* this function will count the characters of a sample spread through the
+ * block, SAMPLE_CHUNK out of every SAMPLE_STRIDE, adding them to counts, and
+ * return how many were counted */
+inline size_t sampleCounts(const unsigned char * contents, size_t n,
+                           unsigned long long counts[256])
+{
+    size_t sampled = 0;
+    for (size_t pos = 0; pos < n; pos += SAMPLE_STRIDE)
     {
-        outfile.write((char *)&textInts[i], sizeof(textInts[i]));
-        //cout << "wrote " << hex << textInts[i] << " to file" << endl;
+        size_t m = min(SAMPLE_CHUNK, n - pos);
+        countBytes(contents + pos, m, counts);
+        sampled += m;
     }
-    cout << "wrote encoded text stream to file" << endl;
+    return sampled;
+}
 
-    //close the file
-    outfile.close();
+/* this function will judge whether coding the block could save MIN_SAVING
+ * percent of it, from the order-0 entropy of the sampled characters counted;
+ * a sample has a little less entropy than the whole block, if anything, so
+ * the blocks it rules out could not have been coded any shorter */
+inline bool worthCoding(const unsigned long long counts[256], size_t sampled)
+{
+    double bits = 0;
+    for (int c = 0; c < 256; c++)
+        if (counts[c] > 0)
+            bits += counts[c] * log2((double)sampled / counts[c]);
+    return bits * 100 <= 8.0 * sampled * (100 - MIN_SAVING);
 }
 
-/* this function will take a binary string and break it up into several
- * 4 byte integers */
-vector <uint> splitBinary(string binary)
+/* this function will build the database from counts estimated for the whole
+ * block, giving every character one more than its count so that those the
+ * sample missed still get a code; a table with every character in it can
+ * also be repeated by any block after it */
+inline void sampledCFreqs(const unsigned long long counts[256], vector <cfreq> &cfreqs)
 {
-    vector <uint> integers;
+    cfreqs.resize(256);
+    for (int i = 0; i < 256; i++)
+    {
+        cfreqs[i].c = i;
+        cfreqs[i].freq = counts[i] + 1;
+    }
+}
 
-    // count bits the binary will take up
-    int bits;
-    for (int i = 0; i < (int)binary.length(); i++)
-        bits++;
-    // if bits not a multiple of 4 bytes (8x4 = 32bits) add zeros
-    while (bits % 32 != 0)
+/* this function will write the block as it is, after a header of just its
+ * type; when stats are wanted its characters are still counted, so that the
+ * figures cover every block */
+inline void storeBlock(const unsigned char * contents, size_t n, bitwriter &header,
+                       bitwriter &encodedText, blockscratch &scratch, huffstats * stats)
+{
+    initWriter(header);
+    putBits(header, STORED_BLOCK, 8);
+    initWriter(encodedText, n);
+    copyBytes(encodedText, contents, n);
+    if (stats)
     {
-        binary += '0';
-        bits++;
+        stats -> bytesIn = n;
+        stats -> blocks = 1;
+        getCFreqs(contents, n, scratch.cfreqs);
+        scratch.codes.clear();
+        recordCodes(stats, scratch.cfreqs, scratch.codes);
+        stats -> codeBits += 8ULL * n;
     }
-    // print readable for debugging 
-    //cout << "Made multiple of four bytes:" << endl;
-    /*for (int i = 0; i < (int)binary.length(); i++)
+}
+
+/* this function will read a string containing a file's contents and count
+ * the frequency of each unique character, filling cfreqs with structs that
+ * contain each unique character and it's corresponding frequency */
+inline void getCFreqs(const unsigned char * contents, size_t n, vector <cfreq> &cfreqs,
+                      int nthreads)
+{
+    // count every byte value in a table indexed by the byte itself
+    unsigned long long counts[256];
+    countBytesParallel(contents, n, counts, nthreads);
+
+    // build the database from the characters that were seen
+    cfreqs.clear();
+    for (int i = 0; i < 256; i++)
     {
-        cout << binary[i];
-        if ((i+1) % 8 == 0)
-            cout << " ";
+        if (counts[i] > 0)
+        {
+            cfreq temp;
+            temp.c = i;
+            temp.freq = counts[i];
+            cfreqs.push_back(temp);
+        }
     }
-    cout << endl;*/
-    
-    // grab 4 bytes of the string at a time and convert to integer
-    while (binary != "")
+}
+
+/* this function will count how many times each byte value occurs, adding the
+ * counts to the table passed in; four separate tables are used so that runs
+ * of the same byte do not make each increment wait on the one before it */
+inline void countBytes(const unsigned char * bytes, size_t n, unsigned long long counts[256])
+{
+    uint c[4][256];
+    while (n > 0)
     {
-        string fourbytes;
-        for (int i = 0; i < 32; i++)
+        // count in slices small enough that the 4 byte counters cannot overflow
+        size_t slice = min(n, (size_t)1 << 30);
+        memset(c, 0, sizeof(c));
+
+        size_t i = 0;
+        for (; i + 8 <= slice; i += 8)
         {
-            fourbytes += binary[0];
-            binary.erase(binary.begin());
+            // load 8 bytes at once and pick them apart with shifts
+            unsigned long long word;
+            memcpy(&word, bytes + i, sizeof(word));
+            c[0][(unsigned char)word]         ++;
+            c[1][(unsigned char)(word >> 8)]  ++;
+            c[2][(unsigned char)(word >> 16)] ++;
+            c[3][(unsigned char)(word >> 24)] ++;
+            c[0][(unsigned char)(word >> 32)] ++;
+            c[1][(unsigned char)(word >> 40)] ++;
+            c[2][(unsigned char)(word >> 48)] ++;
+            c[3][(unsigned char)(word >> 56)] ++;
         }
-        //cout << "four bytes grabbed: " << fourbytes << endl;
-        //cout << "binary remaining: " << binary << endl;
+        for (; i < slice; i++)
+            c[0][bytes[i]]++;
 
-        uint integer = toDecimal(fourbytes);
-        //cout << "converted four bytes to: " << integer << endl;
-        integers.push_back(integer);
+        for (int j = 0; j < 256; j++)
+            counts[j] += (unsigned long long)c[0][j] + c[1][j] + c[2][j] + c[3][j];
+        bytes += slice;
+        n     -= slice;
     }
-    cout << endl;
-
-    return integers;
 }
 
-/* this function will take a binary string and convert it to an unsigned decimal integer */
-uint toDecimal(string binstr)
+/* this function will count the bytes of a large input on several threads, each
+ * with a histogram of its own, and then merge the histograms into counts */
+inline void countBytesParallel(const unsigned char * bytes, size_t n,
+                               unsigned long long counts[256], int nthreads)
 {
-    uint dec = 0;
-    reverse(binstr.begin(), binstr.end());
-    for (int i = 0; i < (int)binstr.size(); i++) {
-		dec += (int(binstr[i]) - '0') * pow(2, i);
-	}
+    memset(counts, 0, 256 * sizeof(counts[0]));
+    nthreads = (int)min((size_t)max(nthreads, 1), max(n / MIN_COUNT_PER_THREAD, (size_t)1));
+    if (nthreads == 1)
+    {
+        countBytes(bytes, n, counts);
+        return;
+    }
+
+    vector <unsigned long long> partial(256 * nthreads, 0);
+    vector <thread> threads;
+    size_t share = n / nthreads;
+    for (int t = 0; t < nthreads; t++)
+    {
+        // the last thread also takes whatever does not divide evenly
+        size_t start = t * share;
+        size_t count = (t == nthreads - 1) ? n - start : share;
+        threads.push_back(thread(countBytes, bytes + start, count, &partial[256 * t]));
+    }
+    for (int t = 0; t < nthreads; t++)
+    {
+        threads[t].join();
+        for (int j = 0; j < 256; j++)
+            counts[j] += partial[256 * t + j];
+    }
+}
 
-    return dec;
+/* this function serves as a reference for comparing two cfreq structures
+ * by std::algorithm::sort, which will sort by greatest frequency to
+ * least */
+inline bool compareByFreq(const cfreq &a, const cfreq &b)
+{
+    return a.freq > b.freq;
+}
+
+/* this function will use the data found in a character-frequency database
+ * to create a forest of single-node trees at the start of an emptied tree */
+inline void makeForest(const vector <cfreq> &cfreqs, hufftree &tree)
+{
+    resetTree(tree);
+    // create and append single-node trees to the forest
+    for (int i = 0; i < (int)cfreqs.size(); i++)
+    {
+        int newTree = createNode(tree, cfreqs[i].freq, true);
+        tree.nodes[newTree].c = cfreqs[i].c;
+    }
+}
+
+/* this function serves as a reference for sorting single-node trees by
+ * std::algorithm::sort from least frequent to most, and by character among
+ * trees of the same frequency, so that the order is the same without a
+ * stable sort, which would allocate */
+inline bool compareNodesByFreq(const node &a, const node &b)
+{
+    if (a.freq != b.freq)
+        return a.freq < b.freq;
+    return a.c < b.c;
+}
+
+/* this function will merge all the trees in a forest two-by-two until there
+ * is a single Huffman tree remaining, from which prefix codes for the characters
+ * in the file contents can be generated, returning its root; the single-node
+ * trees are sorted once, and since every merged tree is at least as heavy as
+ * the one merged before it, the merged trees, which are added after them in
+ * the tree's array, form a second sorted queue and the two smallest trees are
+ * always at the front of one of the two queues */
+inline int createHuffTree(hufftree &tree)
+{
+    if (tree.size == 0)
+        return tree.root = NO_NODE;
+
+    // queue of single-node trees from least to most frequent
+    int nleaves = tree.size;
+    sort(tree.nodes, tree.nodes + nleaves, compareNodesByFreq);
+    int nextLeaf = 0;
+    // queue of merged trees, there is exactly one per merge
+    int nextMerged = nleaves;
+
+    // repeat until only one tree is left in the two queues
+    while ((nleaves - nextLeaf) + (tree.size - nextMerged) > 1)
+    {
+        int tree1 = takeSmallest(tree, nleaves, nextLeaf, nextMerged);
+        int tree2 = takeSmallest(tree, nleaves, nextLeaf, nextMerged);
+        mergeTree(tree, tree1, tree2);
+    }
+
+    // return newly created huffman tree
+    tree.root = nextLeaf < nleaves ? nextLeaf : nextMerged;
+    return tree.root;
+}
+
+/* this function will remove and return the smallest tree at the front of the
+ * two queues, preferring single-node trees on a tie */
+inline int takeSmallest(hufftree &tree, int nleaves, int &nextLeaf, int &nextMerged)
+{
+    if (nextMerged == tree.size ||
+        (nextLeaf < nleaves && tree.nodes[nextLeaf].freq <= tree.nodes[nextMerged].freq))
+        return nextLeaf++;
+    return nextMerged++;
+}
+
+/* this is a function mainly for debugging purposes that will
+ * print the nodes of a tree (or a forest) in a relatively readable format */
+inline void printForest(hufftree &tree)
+{
+    // find size of forest
+    cout << tree.size << endl;
+
+    // print forest
+    for (int i = 0; i < tree.size; i++)
+    {
+        printNode(tree, i);
+        cout << "   <-->   ";
+    }
+    cout << "\n" << endl;
+}
+
+/* this function will recurse through the tree from node n to generate variable
+ * length prefix codes for each character in the tree */
+inline void genHuffCodes(hufftree &tree, int n, unsigned long long code, int len,
+                         vector<huffcode> &codes)
+{
+    const node &huffTree = tree.nodes[n];
+    // append a 0 to the code if we go left in the tree
+    if (huffTree.left != NO_NODE)
+        genHuffCodes(tree, huffTree.left, code << 1, len + 1, codes);
+    // append a 1 to the code if we go left in the tree
+    if (huffTree.right != NO_NODE)
+        genHuffCodes(tree, huffTree.right, (code << 1) | 1, len + 1, codes);
+    /* if a leaf node is encountered, assign the code and the encountered
+     * character to a huffcode structure, and add it to the vector */
+    if (huffTree.isLeaf)
+    {
+        huffcode ccode;
+        ccode.c = huffTree.c;
+        ccode.code = code;
+        ccode.len = len;
+        codes.push_back(ccode);
+    }
+}
+
+/* this function will fill a table of every character's code and its length,
+ * indexed by the character, for an alphabet of nsymbols symbols; characters
+ * without a code have a length of 0 */
+inline void buildEncodeTable(vector <huffcode> &codes, encodeEntry table[], int nsymbols)
+{
+    memset(table, 0, nsymbols * sizeof(encodeEntry));
+    for (int i = 0; i < (int)codes.size(); i++)
+    {
+        table[codes[i].c].code = codes[i].code;
+        table[codes[i].c].len  = codes[i].len;
+    }
+}
+
+/* this function will iterate through the plain-text contents and translate it using
+ * the huffman codes that were generated previously */
+inline void encodeText(const unsigned char * contents, size_t n, vector <huffcode> &codes,
+                       bitwriter &encodedText)
+{
+    encodeEntry table[256];
+    buildEncodeTable(codes, table);
+    int longest = 0;
+    for (int i = 0; i < (int)codes.size(); i++)
+        longest = max(longest, codes[i].len);
+    encodeWithTable(contents, n, table, longest, encodedText);
+}
+
+/* this function will translate the contents using a table of codes that is
+ * already built, whose longest code is longest bits; fewer than 8 bits are
+ * left in the accumulator after a flush, so four codes of up to 14 bits, or
+ * three of 15, can be added before the next one */
+inline void encodeWithTable(const unsigned char * contents, size_t n, const encodeEntry table[256],
+                            int longest, bitwriter &encodedText)
+{
+    const unsigned char * p = contents;
+    /* the accumulator is kept in local variables, so that the compiler can
+     * tell stores to the buffer do not change it */
+    unsigned long long acc = encodedText.acc;
+    int nbits = encodedText.nbits;
+    size_t i = 0;
+    while (i < n)
+    {
+        // make room for the longest possible output of a chunk, so the loops need no checks
+        size_t end  = min(n, i + ENCODE_CHUNK);
+        size_t room = encodedText.pos + ((end - i) * longest + 7) / 8 + 16;
+        if (encodedText.bytes.size() < room)
+            encodedText.bytes.resize(max(room, encodedText.bytes.size() * 2));
+        unsigned char * out = &encodedText.bytes[encodedText.pos];
+        unsigned char * outStart = out;
+
+        if (longest <= 14)
+        {
+            for (; i + 4 <= end; i += 4)
+            {
+                const encodeEntry &e0 = table[p[i]];
+                const encodeEntry &e1 = table[p[i + 1]];
+                const encodeEntry &e2 = table[p[i + 2]];
+                const encodeEntry &e3 = table[p[i + 3]];
+                /* join the codes in pairs first, so that only one shift of
+                 * the accumulator depends on the shift before it */
+                unsigned long long pair1 = ((unsigned long long)e0.code << e1.len) | e1.code;
+                unsigned long long pair2 = ((unsigned long long)e2.code << e3.len) | e3.code;
+                uint len2 = e2.len + e3.len;
+                uint len  = e0.len + e1.len + len2;
+                acc = (acc << len) | (pair1 << len2) | pair2;
+                nbits += len;
+                storeWord(out, acc << (64 - nbits));
+                out   += nbits >> 3;
+                nbits &= 7;
+            }
+        }
+        else
+        {
+            for (; i + 3 <= end; i += 3)
+            {
+                const encodeEntry &e0 = table[p[i]];
+                const encodeEntry &e1 = table[p[i + 1]];
+                const encodeEntry &e2 = table[p[i + 2]];
+                unsigned long long pair1 = ((unsigned long long)e0.code << e1.len) | e1.code;
+                uint len = e0.len + e1.len + e2.len;
+                acc = (acc << len) | (pair1 << e2.len) | e2.code;
+                nbits += len;
+                storeWord(out, acc << (64 - nbits));
+                out   += nbits >> 3;
+                nbits &= 7;
+            }
+        }
+        for (; i < end; i++)
+        {
+            acc = (acc << table[p[i]].len) | table[p[i]].code;
+            nbits += table[p[i]].len;
+            storeWord(out, acc << (64 - nbits));
+            out   += nbits >> 3;
+            nbits &= 7;
+        }
+        encodedText.pos += out - outStart;
+    }
+
+    encodedText.acc   = acc;
+    encodedText.nbits = nbits;
+}
+
+/* this function will split the block round robin into nstreams streams, so
+ * that character i goes into stream i % nstreams, and encode each stream after
+ * the one before it in encodedText, padded to a whole byte; the size of each
+ * stream in bytes goes in sizes, and stream is used to gather each stream */
+inline void encodeStreams(const unsigned char * contents, size_t n, vector <huffcode> &codes,
+                          int nstreams, bitwriter &encodedText, vector <uint> &sizes,
+                          vector <unsigned char> &stream)
+{
+    sizes.clear();
+    if (nstreams == 1)
+    {
+        encodeText(contents, n, codes, encodedText);
+        alignBits(encodedText);
+        sizes.push_back(encodedText.pos);
+        return;
+    }
+
+    // each stream's characters are gathered together and then encoded
+    stream.resize(n / nstreams + 1);
+    size_t start = encodedText.pos;
+    for (int s = 0; s < nstreams; s++)
+    {
+        size_t m = 0;
+        for (size_t i = s; i < n; i += nstreams)
+            stream[m++] = contents[i];
+        encodeText(&stream[0], m, codes, encodedText);
+        alignBits(encodedText);
+        sizes.push_back(encodedText.pos - start);
+        start = encodedText.pos;
+    }
+}
+
+/* this function will make sure that no code is longer than maxLen bits; if the
+ * Huffman tree is deeper than that, the lengths are recomputed with the
+ * package-merge algorithm, which finds the best lengths within the limit.
+ * Each list below holds the characters as items, merged in order of weight
+ * with packages made by pairing up the items of the list before it; taking
+ * the 2n-2 lightest items of the last list, every character gets a code one
+ * bit long for each list in which it is one of the items taken. There are
+ * never more than MAX_SYMBOLS symbols, so the lists fit in fixed arrays and
+ * nothing is allocated */
+inline void limitCodeLengths(const vector <cfreq> &cfreqs, vector <huffcode> &codes, int maxLen)
+{
+    int n = cfreqs.size();
+    int longest = 0;
+    for (int i = 0; i < (int)codes.size(); i++)
+        longest = max(longest, codes[i].len);
+    // a single character still needs a code of one bit
+    if (n == 1)
+    {
+        codes[0].len = 1;
+        return;
+    }
+    if (longest <= maxLen)
+        return;
+    // there must be room for n codes of maxLen bits
+    while ((1 << maxLen) < n)
+        maxLen++;
+
+    // characters from least to most frequent
+    cfreq sorted[MAX_SYMBOLS];
+    copy(cfreqs.begin(), cfreqs.end(), sorted);
+    sort(sorted, sorted + n, compareByFreq);
+    reverse(sorted, sorted + n);
+
+    /* each list holds which character each item is, or -1 for a package of
+     * two items from the list before; only the weights of the list before are
+     * needed to make the next one */
+    short items[MAX_CODE_LEN][2 * MAX_SYMBOLS];
+    int   nitems[MAX_CODE_LEN];
+    unsigned long long weights[2][2 * MAX_SYMBOLS];
+    for (int level = 0; level < maxLen; level++)
+    {
+        int leaf = 0;
+        int pkg = 0;
+        unsigned long long * prev = weights[(level + 1) & 1];
+        unsigned long long * cur  = weights[level & 1];
+        int npkgs = level ? nitems[level - 1] / 2 : 0;
+        int m = 0;
+        while (leaf < n || pkg < npkgs)
+        {
+            unsigned long long pkgWeight = pkg < npkgs ? prev[2 * pkg] + prev[2 * pkg + 1] : 0;
+            if (pkg == npkgs || (leaf < n && (unsigned long long)sorted[leaf].freq <= pkgWeight))
+            {
+                cur[m] = sorted[leaf].freq;
+                items[level][m++] = leaf++;
+            }
+            else
+            {
+                cur[m] = pkgWeight;
+                items[level][m++] = -1;
+                pkg++;
+            }
+        }
+        nitems[level] = m;
+    }
+
+    /* walk back from the last list, counting the characters taken from each;
+     * taking the first k packages of a list takes the first 2k items of the
+     * list before it */
+    int lengths[MAX_SYMBOLS] = { 0 };
+    int take = 2 * n - 2;
+    for (int level = maxLen - 1; level >= 0; level--)
+    {
+        int npkgs = 0;
+        for (int i = 0; i < take; i++)
+        {
+            if (items[level][i] < 0)
+                npkgs++;
+            else
+                lengths[items[level][i]]++;
+        }
+        take = 2 * npkgs;
+    }
+
+    for (int i = 0; i < (int)codes.size(); i++)
+        for (int j = 0; j < n; j++)
+            if (sorted[j].c == codes[i].c)
+                codes[i].len = lengths[j];
+}
+
+/* this function serves as a reference for sorting codes by std::algorithm::sort
+ * from shortest to longest, and by character among codes of the same length */
+inline bool compareByLength(const huffcode &a, const huffcode &b)
+{
+    if (a.len != b.len)
+        return a.len < b.len;
+    return a.c < b.c;
+}
+
+/* this function will assign canonical codes to characters whose code lengths
+ * are already known: codes are handed out in order of length and then of
+ * character, each one more than the last, so that they depend only on the
+ * lengths */
+inline void canonicalCodes(vector <huffcode> &codes)
+{
+    sort(codes.begin(), codes.end(), compareByLength);
+    unsigned long long code = 0;
+    int len = codes.size() ? codes[0].len : 0;
+    for (int i = 0; i < (int)codes.size(); i++)
+    {
+        // a longer code continues from the shorter ones followed by zeros
+        code <<= codes[i].len - len;
+        len = codes[i].len;
+        codes[i].code = code++;
+    }
+}
+
+/* this function will write the length of every character's code into the
+ * header, in order of character, for an alphabet of nsymbols symbols: a
+ * length is 4 bits, and a 0 is followed by 5 more bits giving a run of 1 to
+ * 32 characters that have no code */
+inline void writeCodeLengths(vector <huffcode> &codes, bitwriter &header, int nsymbols)
+{
+    int lens[MAX_SYMBOLS] = {0};
+    for (int i = 0; i < (int)codes.size(); i++)
+        lens[codes[i].c] = codes[i].len;
+
+    int i = 0;
+    while (i < nsymbols)
+    {
+        if (lens[i])
+        {
+            putBits(header, lens[i], 4);
+            i++;
+            continue;
+        }
+        int run = 1;
+        while (i + run < nsymbols && run < 32 && !lens[i + run])
+            run++;
+        putBits(header, run - 1, 9);
+        i += run;
+    }
+}
+
+/* this function will write the number of streams less one in 4 bits, and
+ * then the size in bytes of every stream but the last in 32 bits, which is
+ * all the decoder needs to find where each stream starts */
+inline void writeStreamTable(vector <uint> &sizes, bitwriter &header)
+{
+    putBits(header, sizes.size() - 1, 4);
+    for (size_t s = 0; s + 1 < sizes.size(); s++)
+        putBits(header, sizes[s], 32);
+}
+
+/* this function will record how often each character of the block occurs,
+ * the entropy of the block and the bits its codes take, for --stats */
+inline void recordCodes(huffstats * stats, vector <cfreq> &cfreqs, vector <huffcode> &codes)
+{
+    int lens[256] = { 0 };
+    for (size_t i = 0; i < codes.size(); i++)
+    {
+        lens[(unsigned char)codes[i].c] = codes[i].len;
+        stats -> maxCodeLen = max(stats -> maxCodeLen, codes[i].len);
+    }
+    for (size_t i = 0; i < cfreqs.size(); i++)
+    {
+        unsigned char c = cfreqs[i].c;
+        double p = (double)cfreqs[i].freq / stats -> bytesIn;
+        stats -> counts[c] += cfreqs[i].freq;
+        stats -> entropyBits -= cfreqs[i].freq * log2(p);
+        stats -> codeBits += (unsigned long long)cfreqs[i].freq * lens[c];
+    }
+}
+
+/* this function will write one block to the binary file: the number of
+ * characters in it, the number of bytes that follow, the code lengths and
+ * stream table and then the encoded streams, each padded to a whole byte */
+inline bool writeToFile(ostream &outfile, uint sizeofBlock, bitwriter &header,
+                        bitwriter &encodedText)
+{
+    finishBits(header);
+    finishBits(encodedText);
+
+    uint sizeofText = header.bytes.size() + encodedText.bytes.size();
+    outfile.write((char *)&sizeofBlock, sizeof(sizeofBlock));
+    outfile.write((char *)&sizeofText, sizeof(sizeofText));
+    // write the code lengths to file
+    outfile.write((char *)&header.bytes[0], header.bytes.size());
+    // write encoded text to the file
+    if (encodedText.bytes.size() > 0)
+        outfile.write((char *)&encodedText.bytes[0], encodedText.bytes.size());
+
+    return outfile.good();
+}
+
+/* this function will mark the end of the blocks with a block of no characters,
+ * followed by the index of the blocks, the number of blocks, and the number of
+ * characters in the whole file; the last two are always the final 16 bytes, so
+ * the index can be found by seeking back from the end of the file */
+inline bool writeTrailer(ostream &outfile, vector <blockindex> &index,
+                         unsigned long long sizeofFile)
+{
+    uint endOfBlocks = 0;
+    outfile.write((char *)&endOfBlocks, sizeof(endOfBlocks));
+    for (size_t i = 0; i < index.size(); i++)
+    {
+        outfile.write((char *)&index[i].offset, sizeof(index[i].offset));
+        outfile.write((char *)&index[i].sizeofBlock, sizeof(index[i].sizeofBlock));
+        outfile.write((char *)&index[i].sizeofText, sizeof(index[i].sizeofText));
+    }
+    unsigned long long nblocks = index.size();
+    outfile.write((char *)&nblocks, sizeof(nblocks));
+    outfile.write((char *)&sizeofFile, sizeof(sizeofFile));
+    return outfile.good();
+}
+
+/* this function will compress the input in a single pass, for input that
+ * cannot be held or read twice, such as a live pipe or socket: the codes
+ * follow the counts of the characters coded so far, which the extractor
+ * keeps the same way, so no codes are stored in the file. With no
+ * rebuildInterval the tree is updated after every character (the FGK
+ * algorithm); otherwise canonical codes of at most maxCodeLen bits are
+ * rebuilt from the counts every rebuildInterval characters, which costs
+ * far less per character. Whatever has been read is coded and written out
+ * straight away, in chunks of at most ADAPTIVE_CHUNK characters, so the
+ * output never lags far behind the input */
+inline void huffCompressAdaptive(string infilename, string outfilename = "out.bin",
+                                 int maxCodeLen = DEFAULT_MAX_CODE_LEN,
+                                 size_t rebuildInterval = 0, huffstats * stats = NULL)
+{
+    inputfile infile;
+    if (!openInput(infilename, infile))
+    {
+        cerr << "Error. Could not open file '" << infilename << "'." << endl;
+        return;
+    }
+    ofstream outfile;
+    vector <char> outbuffer(OUTPUT_BUFFER);
+    if (outfilename != "-")
+    {
+        outfile.rdbuf() -> pubsetbuf(&outbuffer[0], outbuffer.size());
+        outfile.open(outfilename.c_str(), ios::binary | ios::trunc);
+        if (!outfile.is_open())
+        {
+            cerr << "Error. Could not open file '" << outfilename << "'." << endl;
+            closeInput(infile);
+            return;
+        }
+    }
+    ostream &out = outfilename != "-" ? (ostream &)outfile : cout;
+
+    // the extractor has to know how the codes change to change them the same way
+    uint interval = rebuildInterval;
+    uint codeLen = maxCodeLen;
+    out.write(ADAPTIVE_MAGIC, sizeof(ADAPTIVE_MAGIC));
+    out.write((char *)&interval, sizeof(interval));
+    out.write((char *)&codeLen, sizeof(codeLen));
+
+    /* every character starts with a count of 1, so that every character has
+     * a code before it is first seen */
+    adaptivetree tree;
+    initAdaptiveTree(tree);
+    unsigned long long counts[256];
+    blockscratch scratch;
+    size_t sinceRebuild = 0;
+    if (rebuildInterval)
+    {
+        for (int c = 0; c < 256; c++)
+            counts[c] = 1;
+        rebuildCodes(counts, maxCodeLen, scratch.cfreqs, scratch.tree, scratch.codes);
+    }
+
+    bitwriter encodedText;
+    unsigned long long sizeofFile = 0;
+    const unsigned char * contents;
+    size_t n;
+    bool failed = false;
+    stagetimer timer = { 0, 0 };
+    startStage(stats, timer);
+    while (!failed && getAvailable(infile, ADAPTIVE_CHUNK, contents, n))
+    {
+        endStage(stats, READ_STAGE, timer);
+        initWriter(encodedText, n);
+        if (rebuildInterval == 0)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                int len = encodeAdaptive(tree, contents[i], encodedText);
+                if (stats)
+                    stats -> maxCodeLen = max(stats -> maxCodeLen, len);
+            }
+        }
+        else
+        {
+            // code up to the next rebuild with the codes as they are
+            size_t i = 0;
+            while (i < n)
+            {
+                size_t m = min(n - i, rebuildInterval - sinceRebuild);
+                encodeText(contents + i, m, scratch.codes, encodedText);
+                countBytes(contents + i, m, counts);
+                i += m;
+                sinceRebuild += m;
+                if (sinceRebuild == rebuildInterval)
+                {
+                    endStage(stats, ENCODE_STAGE, timer);
+                    rebuildCodes(counts, maxCodeLen, scratch.cfreqs, scratch.tree, scratch.codes);
+                    sinceRebuild = 0;
+                    endStage(stats, CODES_STAGE, timer);
+                }
+            }
+            if (stats)
+                for (size_t c = 0; c < scratch.codes.size(); c++)
+                    stats -> maxCodeLen = max(stats -> maxCodeLen, scratch.codes[c].len);
+        }
+        unsigned long long bits = bitsWritten(encodedText);
+        finishBits(encodedText);
+        endStage(stats, ENCODE_STAGE, timer);
+
+        /* each chunk is laid out like a block with no header, and the output
+         * is flushed so that whatever reads it gets the chunk now */
+        uint sizeofChunk = n;
+        uint sizeofText = encodedText.bytes.size();
+        out.write((char *)&sizeofChunk, sizeof(sizeofChunk));
+        out.write((char *)&sizeofText, sizeof(sizeofText));
+        out.write((char *)&encodedText.bytes[0], sizeofText);
+        failed = !out.flush();
+        sizeofFile += n;
+        if (stats)
+        {
+            stats -> bytesIn += n;
+            stats -> blocks++;
+            stats -> codeBits += bits;
+            stats -> bytesOut += 2 * sizeof(uint) + sizeofText;
+            countBytes(contents, n, stats -> counts);
+        }
+        releaseContents(infile, contents + n);
+        endStage(stats, WRITE_STAGE, timer);
+    }
+
+    if (infile.failed)
+        cerr << "Error while reading file '" << infilename << "'." << endl;
+    // a chunk of no characters ends them, followed by the number of characters
+    uint endOfChunks = 0;
+    out.write((char *)&endOfChunks, sizeof(endOfChunks));
+    out.write((char *)&sizeofFile, sizeof(sizeofFile));
+    if (failed || !out.flush())
+        cerr << "Error while writing file '" << outfilename << "'." << endl;
+    if (stats)
+    {
+        stats -> bytesOut += sizeof(ADAPTIVE_MAGIC) + 3 * sizeof(uint) + sizeof(sizeofFile);
+        for (int c = 0; c < 256; c++)
+            if (stats -> counts[c])
+                stats -> entropyBits -= stats -> counts[c]
+                                        * log2((double)stats -> counts[c] / stats -> bytesIn);
+    }
+
+    closeInput(infile);
+    if (outfilename != "-")
+        outfile.close();
+}
+
+/* this function will write the code c has in the adaptive tree, followed by c
+ * itself if it has not been seen before, and then update the tree, returning
+ * the length of the code */
+inline int encodeAdaptive(adaptivetree &tree, unsigned char c, bitwriter &encodedText)
+{
+    bool seen = tree.leaf[c] != NO_ADAPTIVE_NODE;
+    unsigned char path[MAX_ADAPTIVE_NODES];
+    int len = adaptivePath(tree, seen ? tree.leaf[c] : tree.notYetSeen, path);
+    // the path was found from the leaf up, so it is written from its end
+    int i = len;
+    while (i > 0)
+    {
+        int k = min(i, 24);
+        uint code = 0;
+        for (int j = 0; j < k; j++)
+            code = (code << 1) | path[--i];
+        putBits(encodedText, code, k);
+    }
+    if (!seen)
+        putBits(encodedText, c, 8);
+    updateAdaptiveTree(tree, c);
+    return len;
+}
+
+/* this function will build canonical codes of at most maxCodeLen bits for
+ * every character from its count, the way compressBlock builds them for a
+ * block, and then halve the counts, so that the next codes are built mostly
+ * from the characters since these ones and follow the text as it changes */
+inline void rebuildCodes(unsigned long long counts[256], int maxCodeLen, vector <cfreq> &cfreqs,
+                         hufftree &tree, vector <huffcode> &codes)
+{
+    cfreqs.clear();
+    for (int i = 0; i < 256; i++)
+    {
+        cfreq temp;
+        temp.c = i;
+        temp.freq = counts[i];
+        cfreqs.push_back(temp);
+        // no count drops to 0, so every character keeps a code
+        counts[i] = (counts[i] + 1) / 2;
+    }
+    buildCodes(cfreqs, maxCodeLen, tree, codes);
+}
+
+/* this function will build canonical codes of at most maxCodeLen bits for the
+ * characters in cfreqs, in the same steps compressBlock takes */
+inline void buildCodes(vector <cfreq> &cfreqs, int maxCodeLen, hufftree &tree,
+                       vector <huffcode> &codes)
+{
+    sort(cfreqs.begin(), cfreqs.end(), compareByFreq);
+    makeForest(cfreqs, tree);
+    createHuffTree(tree);
+    codes.clear();
+    genHuffCodes(tree, tree.root, 0, 0, codes);
+    limitCodeLengths(cfreqs, codes, maxCodeLen);
+    canonicalCodes(codes);
+}
+
+/* this function will find the bits the symbols counted in cfreqs take with
+ * codes, and the bits the code lengths take in the header */
+inline unsigned long long codedBits(vector <cfreq> &cfreqs, vector <huffcode> &codes)
+{
+    int lens[MAX_SYMBOLS] = { 0 };
+    int nsymbols = 256;
+    for (size_t i = 0; i < codes.size(); i++)
+    {
+        lens[codes[i].c] = codes[i].len;
+        nsymbols = max(nsymbols, codes[i].c + 1);
+    }
+    unsigned long long bits = lengthBits(lens, nsymbols);
+    for (size_t i = 0; i < cfreqs.size(); i++)
+        bits += (unsigned long long)cfreqs[i].freq * lens[cfreqs[i].c];
+    return bits;
+}
+
+/* this function will try coding the block with a table chosen for each
+ * character by the one before it, its context: the contexts are grouped
+ * into tables by clusterContexts, canonical codes are built for each table,
+ * and the tables are kept if the characters and the tables together take
+ * fewer than fewestBits bits, which is then lowered to match. It returns the
+ * number of tables, or 1 when they take more, leaving the encoding table of
+ * each and the bits the characters take with them in scratch */
+inline int buildContextTables(const unsigned char * contents, size_t n, int maxCodeLen,
+                              blockscratch &scratch, unsigned long long &fewestBits)
+{
+    if (n < MIN_CONTEXT_BLOCK)
+        return 1;
+    countPairs(contents, n, scratch.pairs);
+    int ntables = clusterContexts(scratch);
+    if (ntables == 1)
+        return 1;
+
+    // the bits with the tables, counting the table of every context in the header
+    int lens[256];
+    unsigned long long codeBits = 0;
+    unsigned long long headerBits = 4;
+    for (int p = 0; p < 256; p++)
+        headerBits += scratch.contextTable[p] == (p ? scratch.contextTable[p - 1] : 0) ? 1 : 5;
+    vector <cfreq> &cfreqs = scratch.tableFreqs;
+    for (int t = 0; t < ntables; t++)
+    {
+        uint counts[256] = { 0 };
+        for (int p = 0; p < 256; p++)
+            if (scratch.contextTable[p] == t)
+                for (int c = 0; c < 256; c++)
+                    counts[c] += scratch.pairs[p << 8 | c];
+        cfreqs.clear();
+        for (int c = 0; c < 256; c++)
+        {
+            if (counts[c] > 0)
+            {
+                cfreq temp;
+                temp.c = c;
+                temp.freq = counts[c];
+                cfreqs.push_back(temp);
+            }
+        }
+        buildCodes(cfreqs, maxCodeLen, scratch.tree, scratch.tableCodes[t]);
+
+        memset(lens, 0, sizeof(lens));
+        for (size_t i = 0; i < scratch.tableCodes[t].size(); i++)
+            lens[(unsigned char)scratch.tableCodes[t][i].c] = scratch.tableCodes[t][i].len;
+        headerBits += lengthBits(lens);
+        for (int c = 0; c < 256; c++)
+            codeBits += (unsigned long long)counts[c] * lens[c];
+    }
+    if (codeBits + headerBits >= fewestBits)
+        return 1;
+
+    for (int t = 0; t < ntables; t++)
+        buildEncodeTable(scratch.tableCodes[t], scratch.contextCodes[t]);
+    fewestBits = codeBits + headerBits;
+    scratch.codeBits = codeBits;
+    return ntables;
+}
+
+/* this function will count how many times each character follows each other
+ * one, in pairs[context * 256 + character]; the first character of the block
+ * is counted as following a 0 */
+inline void countPairs(const unsigned char * contents, size_t n, vector <uint> &pairs)
+{
+    pairs.assign(256 * 256, 0);
+    uint * counts = &pairs[0];
+    uint prev = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        counts[prev << 8 | contents[i]]++;
+        prev = contents[i];
+    }
+}
+
+/* this function will group the contexts that occur into at most
+ * MAX_CONTEXT_TABLES tables, filling in the table of every context in scratch
+ * and returning the number of tables. The first table is that of the most
+ * common context, and each one after it that of the context the tables so
+ * far code worst compared to a table of its own. Then, CONTEXT_ROUNDS times,
+ * each context moves to the table that codes it in the fewest bits and the
+ * tables are counted again from the contexts in them. Last, the two tables
+ * whose merging saves the most bits, their code lengths in the header
+ * included, are merged for as long as that saves any */
+inline int clusterContexts(blockscratch &scratch)
+{
+    unsigned char * table = scratch.contextTable;
+    memset(table, 0, 256);
+
+    // list the characters seen after each context, so the rest can be skipped
+    int start[257];
+    int active[256];
+    int nactive = 0;
+    double total[256];
+    scratch.pairChars.clear();
+    scratch.pairCounts.clear();
+    for (int p = 0; p < 256; p++)
+    {
+        start[p] = scratch.pairChars.size();
+        total[p] = 0;
+        for (int c = 0; c < 256; c++)
+        {
+            uint count = scratch.pairs[p << 8 | c];
+            if (count)
+            {
+                scratch.pairChars.push_back(c);
+                scratch.pairCounts.push_back(count);
+                total[p] += count;
+            }
+        }
+        if (total[p] > 0)
+            active[nactive++] = p;
+    }
+    start[256] = scratch.pairChars.size();
+    if (nactive < 2)
+        return 1;
+
+    // the bits each context would take with a table of its own
+    double selfBits[256];
+    double bestBits[256];
+    bool   seeded[256];
+    int seed = active[0];
+    for (int i = 0; i < nactive; i++)
+    {
+        int p = active[i];
+        selfBits[i] = 0;
+        for (int j = start[p]; j < start[p + 1]; j++)
+            selfBits[i] += scratch.pairCounts[j] * log2(total[p] / scratch.pairCounts[j]);
+        seeded[i] = false;
+        if (total[p] > total[seed])
+            seed = p;
+    }
+
+    double hist[MAX_CONTEXT_TABLES][256];
+    double cost[MAX_CONTEXT_TABLES][256];
+    int ntables = 0;
+    while (true)
+    {
+        for (int c = 0; c < 256; c++)
+            hist[ntables][c] = 0;
+        for (int j = start[seed]; j < start[seed + 1]; j++)
+            hist[ntables][scratch.pairChars[j]] = scratch.pairCounts[j];
+        tableCosts(hist[ntables], cost[ntables]);
+        for (int i = 0; i < nactive; i++)
+        {
+            double bits = contextCost(scratch, start, active[i], cost[ntables]);
+            if (ntables == 0 || bits < bestBits[i])
+                bestBits[i] = bits;
+            if (active[i] == seed)
+                seeded[i] = true;
+        }
+        ntables++;
+        if (ntables == MAX_CONTEXT_TABLES || ntables == nactive)
+            break;
+
+        double worst = 0;
+        seed = -1;
+        for (int i = 0; i < nactive; i++)
+        {
+            if (!seeded[i] && bestBits[i] - selfBits[i] > worst)
+            {
+                worst = bestBits[i] - selfBits[i];
+                seed = active[i];
+            }
+        }
+        if (seed < 0)
+            break;
+    }
+
+    for (int round = 0; round < CONTEXT_ROUNDS; round++)
+    {
+        // move each context to the table that codes it in the fewest bits
+        for (int i = 0; i < nactive; i++)
+        {
+            int p = active[i];
+            int best = 0;
+            double fewest = contextCost(scratch, start, p, cost[0]);
+            for (int t = 1; t < ntables; t++)
+            {
+                double bits = contextCost(scratch, start, p, cost[t]);
+                if (bits < fewest)
+                {
+                    fewest = bits;
+                    best = t;
+                }
+            }
+            table[p] = best;
+        }
+
+        // count the tables again, dropping any that were left with no contexts
+        for (int t = 0; t < ntables; t++)
+            for (int c = 0; c < 256; c++)
+                hist[t][c] = 0;
+        double tableTotal[MAX_CONTEXT_TABLES] = { 0 };
+        for (int i = 0; i < nactive; i++)
+        {
+            int p = active[i];
+            for (int j = start[p]; j < start[p + 1]; j++)
+                hist[table[p]][scratch.pairChars[j]] += scratch.pairCounts[j];
+            tableTotal[table[p]] += total[p];
+        }
+        int renumber[MAX_CONTEXT_TABLES];
+        int kept = 0;
+        for (int t = 0; t < ntables; t++)
+        {
+            if (tableTotal[t] == 0)
+                continue;
+            if (kept != t)
+                memcpy(hist[kept], hist[t], sizeof(hist[t]));
+            renumber[t] = kept++;
+        }
+        for (int i = 0; i < nactive; i++)
+            table[active[i]] = renumber[table[active[i]]];
+        ntables = kept;
+        for (int t = 0; t < ntables; t++)
+            tableCosts(hist[t], cost[t]);
+    }
+
+    double bits[MAX_CONTEXT_TABLES];
+    for (int t = 0; t < ntables; t++)
+        bits[t] = tableBits(hist[t]);
+    while (ntables > 1)
+    {
+        int a = -1;
+        int b = -1;
+        double most = 0;
+        double merged[256];
+        for (int i = 0; i < ntables; i++)
+        {
+            for (int j = i + 1; j < ntables; j++)
+            {
+                for (int c = 0; c < 256; c++)
+                    merged[c] = hist[i][c] + hist[j][c];
+                double saved = bits[i] + bits[j] - tableBits(merged);
+                if (saved > most)
+                {
+                    most = saved;
+                    a = i;
+                    b = j;
+                }
+            }
+        }
+        if (a < 0)
+            break;
+
+        // b is merged into a, and the last table takes the place of b
+        for (int c = 0; c < 256; c++)
+            hist[a][c] += hist[b][c];
+        bits[a] = tableBits(hist[a]);
+        ntables--;
+        memcpy(hist[b], hist[ntables], sizeof(hist[b]));
+        bits[b] = bits[ntables];
+        for (int i = 0; i < nactive; i++)
+        {
+            int p = active[i];
+            if (table[p] == b)
+                table[p] = a;
+            else if (table[p] == ntables)
+                table[p] = b;
+        }
+    }
+
+    // contexts that never occur take the table before them, which is cheapest to store
+    for (int p = 0; p < 256; p++)
+        if (total[p] == 0)
+            table[p] = p ? table[p - 1] : 0;
+    return ntables;
+}
+
+/* this function will find the bits each character would take with a table
+ * of the counts in hist; a character the table has not seen is taken to have
+ * been seen CONTEXT_ESCAPE times */
+inline void tableCosts(const double hist[256], double cost[256])
+{
+    double total = 256 * CONTEXT_ESCAPE;
+    for (int c = 0; c < 256; c++)
+        total += hist[c];
+    for (int c = 0; c < 256; c++)
+        cost[c] = log2(total / (hist[c] + CONTEXT_ESCAPE));
+}
+
+/* this function will add up the bits the characters seen after context p
+ * would take with the costs of a table */
+inline double contextCost(blockscratch &scratch, const int start[257], int p,
+                          const double cost[256])
+{
+    double bits = 0;
+    for (int j = start[p]; j < start[p + 1]; j++)
+        bits += scratch.pairCounts[j] * cost[scratch.pairChars[j]];
+    return bits;
+}
+
+/* this function will estimate the bits a table takes, from the entropy of the
+ * characters counted in hist and the bits their code lengths take in the header */
+inline double tableBits(const double hist[256])
+{
+    double total = 0;
+    for (int c = 0; c < 256; c++)
+        total += hist[c];
+    int lens[256];
+    double bits = 0;
+    for (int c = 0; c < 256; c++)
+    {
+        lens[c] = hist[c] > 0;
+        if (hist[c] > 0)
+            bits += hist[c] * log2(total / hist[c]);
+    }
+    return bits + lengthBits(lens);
+}
+
+/* this function will find the bits writeCodeLengths takes to write these
+ * code lengths for an alphabet of nsymbols symbols */
+inline int lengthBits(const int lens[], int nsymbols)
+{
+    int bits = 0;
+    int i = 0;
+    while (i < nsymbols)
+    {
+        if (lens[i])
+        {
+            bits += 4;
+            i++;
+            continue;
+        }
+        int run = 1;
+        while (i + run < nsymbols && run < 32 && !lens[i + run])
+            run++;
+        bits += 9;
+        i += run;
+    }
+    return bits;
+}
+
+/* this function will encode the block with the table of each character's
+ * context, split round robin into nstreams streams as encodeStreams splits it,
+ * each padded to a whole byte; the context is the character before in the
+ * block, whichever stream that went into, and the first character's is 0 */
+inline void encodeContexts(const unsigned char * contents, size_t n, int nstreams,
+                           blockscratch &scratch, bitwriter &encodedText, vector <uint> &sizes)
+{
+    // the codes for each context, looked up directly by the character before
+    const encodeEntry * byContext[256];
+    for (int p = 0; p < 256; p++)
+        byContext[p] = scratch.contextCodes[scratch.contextTable[p]];
+
+    sizes.clear();
+    size_t start = encodedText.pos;
+    for (int s = 0; s < nstreams; s++)
+    {
+        unsigned long long acc = encodedText.acc;
+        int nbits = encodedText.nbits;
+        size_t i = s;
+        if (i == 0 && n > 0)
+        {
+            putBits(encodedText, byContext[0][contents[0]].code, byContext[0][contents[0]].len);
+            acc = encodedText.acc;
+            nbits = encodedText.nbits;
+            i += nstreams;
+        }
+        while (i < n)
+        {
+            // make room for the longest possible output of a chunk, so the loop needs no checks
+            size_t end  = min(n, i + ENCODE_CHUNK * nstreams);
+            size_t room = encodedText.pos + ((end - i) / nstreams + 1) * MAX_CODE_LEN / 8 + 16;
+            if (encodedText.bytes.size() < room)
+                encodedText.bytes.resize(max(room, encodedText.bytes.size() * 2));
+            unsigned char * out = &encodedText.bytes[encodedText.pos];
+            unsigned char * outStart = out;
+            for (; i < end; i += nstreams)
+            {
+                const encodeEntry &e = byContext[contents[i - 1]][contents[i]];
+                acc = (acc << e.len) | e.code;
+                nbits += e.len;
+                storeWord(out, acc << (64 - nbits));
+                out   += nbits >> 3;
+                nbits &= 7;
+            }
+            encodedText.pos += out - outStart;
+        }
+        encodedText.acc   = acc;
+        encodedText.nbits = nbits;
+        alignBits(encodedText);
+        sizes.push_back(encodedText.pos - start);
+        start = encodedText.pos;
+    }
+}
+
+/* this function will write the tables of a context block into the header: the
+ * number of tables less one in 4 bits, then the table of every context, as a
+ * 0 bit if it is the same as the context before's, or table 0 for the first,
+ * and otherwise a 1 bit and the table in 4 bits, and then the code lengths of
+ * each table as writeCodeLengths writes them */
+inline void writeContextTables(blockscratch &scratch, int ntables, bitwriter &header)
+{
+    putBits(header, ntables - 1, 4);
+    int prev = 0;
+    for (int p = 0; p < 256; p++)
+    {
+        int t = scratch.contextTable[p];
+        if (t == prev)
+            putBits(header, 0, 1);
+        else
+            putBits(header, 16 | t, 5);
+        prev = t;
+    }
+    for (int t = 0; t < ntables; t++)
+        writeCodeLengths(scratch.tableCodes[t], header);
+}
+
+/* this function will try coding the block with LZ: the matches are found at
+ * the level and within the window of opts, and codes are built for the
+ * characters and match lengths together and for the distances. The tables
+ * are kept if they, the codes and the extra bits take fewer than fewestBits
+ * bits, which is then lowered to match, returning whether they were kept */
+inline bool buildLzTables(const unsigned char * contents, size_t n, const huffoptions &opts,
+                          blockscratch &scratch, unsigned long long &fewestBits)
+{
+    findMatches(contents, n, opts, scratch);
+    if (scratch.lzMatches.empty())
+        return false;
+
+    // count every symbol, and add up the extra bits after them
+    uint counts[LITLEN_SYMBOLS] = { 0 };
+    uint distCounts[DIST_CODES] = { 0 };
+    unsigned long long bits = 0;
+    for (size_t i = 0; i < scratch.lzSymbols.size(); i++)
+        counts[scratch.lzSymbols[i]]++;
+    for (size_t i = 0; i < scratch.lzMatches.size(); i += 2)
+    {
+        uint extra;
+        int extraBits;
+        lzBucket(scratch.lzMatches[i] - MIN_MATCH, 2, extra, extraBits);
+        bits += extraBits;
+        distCounts[lzBucket(scratch.lzMatches[i + 1] - 1, 1, extra, extraBits)]++;
+        bits += extraBits;
+    }
+
+    vector <cfreq> &cfreqs = scratch.tableFreqs;
+    cfreqs.clear();
+    for (int c = 0; c < LITLEN_SYMBOLS; c++)
+    {
+        if (counts[c] > 0)
+        {
+            cfreq temp;
+            temp.c = c;
+            temp.freq = counts[c];
+            cfreqs.push_back(temp);
+        }
+    }
+    buildCodes(cfreqs, opts.maxCodeLen, scratch.tree, scratch.litlenCodes);
+    cfreqs.clear();
+    for (int c = 0; c < DIST_CODES; c++)
+    {
+        if (distCounts[c] > 0)
+        {
+            cfreq temp;
+            temp.c = c;
+            temp.freq = distCounts[c];
+            cfreqs.push_back(temp);
+        }
+    }
+    buildCodes(cfreqs, opts.maxCodeLen, scratch.tree, scratch.distCodes);
+
+    // the code lengths in the header are written for exactly these alphabets
+    int lens[MAX_SYMBOLS] = { 0 };
+    for (size_t i = 0; i < scratch.litlenCodes.size(); i++)
+        lens[scratch.litlenCodes[i].c] = scratch.litlenCodes[i].len;
+    unsigned long long headerBits = lengthBits(lens, LITLEN_SYMBOLS);
+    memset(lens, 0, sizeof(lens));
+    for (size_t i = 0; i < scratch.distCodes.size(); i++)
+        lens[scratch.distCodes[i].c] = scratch.distCodes[i].len;
+    headerBits += lengthBits(lens, DIST_CODES);
+    for (int c = 0; c < DIST_CODES; c++)
+        bits += (unsigned long long)distCounts[c] * lens[c];
+    for (size_t i = 0; i < scratch.litlenCodes.size(); i++)
+        bits += (unsigned long long)counts[scratch.litlenCodes[i].c] * scratch.litlenCodes[i].len;
+    if (bits + headerBits >= fewestBits)
+        return false;
+
+    buildEncodeTable(scratch.litlenCodes, scratch.litlenTable, LITLEN_SYMBOLS);
+    buildEncodeTable(scratch.distCodes, scratch.distTable, DIST_CODES);
+    fewestBits = bits + headerBits;
+    scratch.codeBits = bits;
+    return true;
+}
+
+/* this function will find the matches the block is coded with, as a list of
+ * steps, each a character or the length code of a match, with the length and
+ * distance of every match in a list of their own. Each place is matched
+ * against the earlier places with the same hash, the nearest first, taking the
+ * longest match; at the lazy levels a match is put off for a character when
+ * the next place starts a longer one, looking less hard after a good match */
+inline void findMatches(const unsigned char * contents, size_t n, const huffoptions &opts,
+                        blockscratch &scratch)
+{
+    const lzlevel &level = LZ_LEVELS[opts.lzLevel];
+    scratch.head.assign(1 << LZ_HASH_BITS, -1);
+    scratch.prev.resize(n);
+    scratch.lzSymbols.clear();
+    scratch.lzMatches.clear();
+
+    size_t i = 0;
+    uint len = 0;
+    uint dist = 0;
+    bool found = false;  // the match at i was found while looking one place ahead
+    while (i < n)
+    {
+        if (!found)
+        {
+            len = longestMatch(contents, n, i, opts.window, level.chain, level.nice, scratch,
+                               dist);
+            insertHash(contents, n, i, scratch);
+        }
+        found = false;
+        if (len == 0)
+        {
+            scratch.lzSymbols.push_back(contents[i++]);
+            continue;
+        }
+
+        size_t inserted = i + 1;
+        if (level.lazy && len < level.nice && i + 1 < n)
+        {
+            uint nextDist;
+            int chain = len >= level.good ? level.chain / 4 : level.chain;
+            uint nextLen = longestMatch(contents, n, i + 1, opts.window, chain, level.nice,
+                                        scratch, nextDist);
+            insertHash(contents, n, i + 1, scratch);
+            if (nextLen > len)
+            {
+                scratch.lzSymbols.push_back(contents[i++]);
+                len = nextLen;
+                dist = nextDist;
+                found = true;
+                continue;
+            }
+            inserted = i + 2;
+        }
+
+        uint extra;
+        int extraBits;
+        scratch.lzSymbols.push_back(256 + lzBucket(len - MIN_MATCH, 2, extra, extraBits));
+        scratch.lzMatches.push_back(len);
+        scratch.lzMatches.push_back(dist);
+        // the places inside the match can still be matched later on
+        for (size_t k = inserted; k < i + len; k++)
+            insertHash(contents, n, k, scratch);
+        i += len;
+    }
+}
+
+/* this function will find the longest match for the characters at i among the
+ * earlier places with the same hash, no more than window back, following the
+ * chain of them for at most chain places and stopping at a match nice long;
+ * it returns the length of the match, or 0 if there is none of MIN_MATCH
+ * characters, and sets dist */
+inline uint longestMatch(const unsigned char * contents, size_t n, size_t i, size_t window,
+                         int chain, uint nice, blockscratch &scratch, uint &dist)
+{
+    if (i + MIN_MATCH > n)
+        return 0;
+    uint most = min((size_t)MAX_MATCH, n - i);
+    uint best = MIN_MATCH - 1;
+    const unsigned char * p = contents + i;
+    int cand = scratch.head[hashAt(p)];
+    while (cand >= 0 && i - cand <= window && chain-- > 0)
+    {
+        const unsigned char * q = contents + cand;
+        // a place that cannot beat the best match so far is passed over quickly
+        if (q[best] == p[best] && q[0] == p[0] && q[1] == p[1])
+        {
+            uint len = matchLength(p, q, most);
+            if (len > best)
+            {
+                best = len;
+                dist = i - cand;
+                if (len >= nice || len == most)
+                    break;
+            }
+        }
+        cand = scratch.prev[cand];
+    }
+    return best >= MIN_MATCH ? best : 0;
+}
+
+/* this function will find how many of the first most characters at p and q
+ * are the same, comparing 8 at a time */
+inline uint matchLength(const unsigned char * p, const unsigned char * q, uint most)
+{
+    uint len = 0;
+    while (len + 8 <= most)
+    {
+        unsigned long long a, b;
+        memcpy(&a, p + len, sizeof(a));
+        memcpy(&b, q + len, sizeof(b));
+        if (a != b)
+            break;
+        len += 8;
+    }
+    while (len < most && p[len] == q[len])
+        len++;
+    return len;
+}
+
+/* this function will hash the MIN_MATCH characters at p into LZ_HASH_BITS bits */
+inline uint hashAt(const unsigned char * p)
+{
+    uint v = (uint)p[0] << 16 | (uint)p[1] << 8 | p[2];
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* this function will add place i to the front of the chain for its hash */
+inline void insertHash(const unsigned char * contents, size_t n, size_t i, blockscratch &scratch)
+{
+    if (i + MIN_MATCH > n)
+        return;
+    uint h = hashAt(contents + i);
+    scratch.prev[i] = scratch.head[h];
+    scratch.head[h] = i;
+}
+
+/* this function will find the place of the highest bit set in v, which is not 0 */
+inline int highestBit(uint v)
+{
+#ifdef __GNUC__
+    return 31 - __builtin_clz(v);
+#else
+    int h = 0;
+    while (v >>= 1)
+        h++;
+    return h;
+#endif
+}
+
+/* this function will find the code for a value v, a match length or distance
+ * less its least; the values below 2 << mbits each have a code of their own,
+ * and above them each power of two is split into 1 << mbits codes, followed
+ * by the extraBits bits of extra that pick v out of the values of its code */
+inline uint lzBucket(uint v, int mbits, uint &extra, int &extraBits)
+{
+    if (v < (2u << mbits))
+    {
+        extra = 0;
+        extraBits = 0;
+        return v;
+    }
+    extraBits = highestBit(v) - mbits;
+    extra = v & ((1u << extraBits) - 1);
+    return (extraBits << mbits) + (v >> extraBits);
+}
+
+/* this function will find the least value with the given code, and how many
+ * bits of extra follow the code, the other way round from lzBucket */
+inline uint lzBucketBase(uint code, int mbits, int &extraBits)
+{
+    if (code < (2u << mbits))
+    {
+        extraBits = 0;
+        return code;
+    }
+    extraBits = (code >> mbits) - 1;
+    return ((code & ((1u << mbits) - 1)) | (1u << mbits)) << extraBits;
+}
+
+/* this function will encode the steps found by findMatches as a single stream:
+ * each character or length code, then for a match the extra bits of its
+ * length, the code of its distance and the extra bits of that */
+inline void encodeLz(blockscratch &scratch, bitwriter &encodedText, vector <uint> &sizes)
+{
+    const encodeEntry * litlen = scratch.litlenTable;
+    const encodeEntry * dist = scratch.distTable;
+    size_t m = 0;
+    for (size_t i = 0; i < scratch.lzSymbols.size(); i++)
+    {
+        uint symbol = scratch.lzSymbols[i];
+        putBits(encodedText, litlen[symbol].code, litlen[symbol].len);
+        if (symbol < 256)
+            continue;
+
+        uint extra;
+        int extraBits;
+        lzBucket(scratch.lzMatches[m] - MIN_MATCH, 2, extra, extraBits);
+        putBits(encodedText, extra, extraBits);
+        uint code = lzBucket(scratch.lzMatches[m + 1] - 1, 1, extra, extraBits);
+        putBits(encodedText, dist[code].code, dist[code].len);
+        putBits(encodedText, extra, extraBits);
+        m += 2;
+    }
+    alignBits(encodedText);
+    sizes.clear();
+    sizes.push_back(encodedText.pos);
+}
+
+/* this function will write the code lengths of an LZ block into the header,
+ * as writeCodeLengths writes them, for the characters and length codes and
+ * then for the distance codes */
+inline void writeLzTables(blockscratch &scratch, bitwriter &header)
+{
+    writeCodeLengths(scratch.litlenCodes, header, LITLEN_SYMBOLS);
+    writeCodeLengths(scratch.distCodes, header, DIST_CODES);
 }
 
 #endif
@@ -32,97 +32,110 @@
 
 using namespace std;
 
-/* node structure for the huffman tree with parent pointers */
+/* a tree is built over at most MAX_SYMBOLS symbols: the 256 characters, and
+ * in LZ blocks the codes for the lengths of matches as well; a tree over all
+ * of them has at most MAX_NODES nodes */
+const int MAX_SYMBOLS = 288;
+const int MAX_NODES   = 2 * MAX_SYMBOLS - 1;
+// child index of a node that has no such child
+const unsigned short NO_NODE = 0xffff;
+
+/* node structure for the huffman tree; children are found by their index in
+ * the tree's array of nodes */
 struct node
 {
-    int  freq;      // frequency of occurance for each character
-    char c;         // the character itself
-    bool isLeaf;    // is the node a leaf?
-    node * left;    // left child for non-leaf nodes
-    node * right;   // right child for non-leaf nodes
+    int  freq;              // frequency of occurance for each character
+    unsigned short c;       // the character, or symbol, itself
+    bool isLeaf;            // is the node a leaf?
+    unsigned short left;    // left child for non-leaf nodes
+    unsigned short right;   // right child for non-leaf nodes
+};
+
+/* structure used to hold a whole huffman tree in one array, which is used as
+ * an arena: nodes are added at the end, and the tree is emptied by resetting
+ * it rather than by freeing every node, so building a tree allocates nothing */
+struct hufftree
+{
+    node nodes[MAX_NODES];
+    int  size;              // number of nodes in use
+    int  root;              // index of the root node, NO_NODE if there is none
 };
 
 /* prototypes for tree functions */
-node * createNode(int freq, bool isLeaf);
-void   printNode(node * Node);
-void   printTree(node * tree);
-void   destroy(node * tree);
-node * mergeTree(node * tree1, node * tree2);
+void   resetTree(hufftree &tree);
+int    createNode(hufftree &tree, int freq, bool isLeaf);
+void   printNode(hufftree &tree, int n);
+void   printTree(hufftree &tree, int n);
+int    mergeTree(hufftree &tree, int tree1, int tree2);
+
+/* function to empty a tree so its nodes can be used again */
+inline void resetTree(hufftree &tree)
+{
+    tree.size = 0;
+    tree.root = NO_NODE;
+}
 
-/* function to create a new node */
-node * createNode(int freq, bool isLeaf)
+/* function to create a new node at the end of the tree, returning its index */
+inline int createNode(hufftree &tree, int freq, bool isLeaf)
 {
-    node * newNode      = new node;
-    newNode -> freq     = freq;
+    node &newNode   = tree.nodes[tree.size];
+    newNode.freq    = freq;
     // non-leaf nodes will have a non-character value assigned
-    newNode -> c = -1; /* maybe do: newNode -> c = '\0' instead */
-    newNode -> isLeaf   = isLeaf;
-    newNode -> left     = NULL;
-    newNode -> right    = NULL;
+    newNode.c       = -1; /* maybe do: newNode.c = '\0' instead */
+    newNode.isLeaf  = isLeaf;
+    newNode.left    = NO_NODE;
+    newNode.right   = NO_NODE;
     //cout << "created new node @ ";
-    //printNode(newNode);
-    return newNode;
+    //printNode(tree, tree.size);
+    return tree.size++;
 }
 
 /* function to print an individual node */
-void printNode(node * Node)
+inline void printNode(hufftree &tree, int n)
 {
-    cout << "addr = " << Node;
-    if (!(Node -> isLeaf))
+    cout << "index = " << n;
+    if (!(tree.nodes[n].isLeaf))
     {
-        cout << " left = "  << Node -> left;
-        cout << " right = " << Node -> right;
+        cout << " left = "  << tree.nodes[n].left;
+        cout << " right = " << tree.nodes[n].right;
     }
     else
-        cout << " char = "  << Node -> c;
-    cout << " freq = " << Node -> freq;
+        cout << " char = "  << tree.nodes[n].c;
+    cout << " freq = " << tree.nodes[n].freq;
 }
 
 /* function to recursively print an entire tree */
-void printTree(node * tree)
+inline void printTree(hufftree &tree, int n)
 {
-    if (tree != NULL)
+    if (n != NO_NODE)
     {
-        printTree(tree -> left);
-        printNode(tree);
+        printTree(tree, tree.nodes[n].left);
+        printNode(tree, n);
         cout << endl;
-        printTree(tree -> right);
-    }
-}
-
-/* function to recursively destroy an entire tree */
-void destroy(node * tree)
-{
-    if (tree != NULL)
-    {
-        if (tree -> left != NULL)
-            destroy(tree -> left);
-        if (tree -> right != NULL)
-            destroy(tree -> right);
-        delete tree;
+        printTree(tree, tree.nodes[n].right);
     }
 }
 
 /* function to merge two trees together */
-node * mergeTree(node * tree1, node * tree2)
+inline int mergeTree(hufftree &tree, int tree1, int tree2)
 {
-    int freq1 = tree1 -> freq;
-    int freq2 = tree2 -> freq;
+    int freq1 = tree.nodes[tree1].freq;
+    int freq2 = tree.nodes[tree2].freq;
     // find the frequency of the new tree's root node
     int sum = freq1 + freq2;    
     // create new root node for the merged tree, the root node is not a leaf
-    node * mergedTree = createNode(sum, false);
+    int mergedTree = createNode(tree, sum, false);
     
     // determine how the subtrees are assigned as children to the root node
     if (freq1 > freq2)
     {
-        mergedTree -> right = tree1;
-        mergedTree -> left = tree2;
+        tree.nodes[mergedTree].right = tree1;
+        tree.nodes[mergedTree].left = tree2;
     }
     else
     {
-        mergedTree -> right = tree2;
-        mergedTree -> left = tree1;
+        tree.nodes[mergedTree].right = tree2;
+        tree.nodes[mergedTree].left = tree1;
     }
     
     return mergedTree;
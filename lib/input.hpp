@@ -0,0 +1,255 @@
+/* input.hpp
+ * Written by:  Keefer Rourke
+ * License:     GPLv3
+ *
+ * COPYRIGHT    Keefer Rourke 2015
+ *
+ * Description: This header file contains a set of functions required
+ *              for reading the input file as a read-only span of bytes,
+ *              mapping it into memory where possible so that it is
+ *              compressed without being copied
+ *
+ * Disclaimer:  This program is free software: you can redistribute it
+ *              and/or modify it under the terms of the GNU General
+ *              Public License as published by the Free Software
+ *              Foundation, either version 3 of the License, or (at
+ *              your option) any later version.
+ *
+ *              This program is distributed in the hope that it will
+ *              be useful, but WITHOUT ANY WARRANTY; without even the
+ *              implied warranty of MERCHANTABILITY or FITNESS FOR A
+ *              PARTICULAR PURPOSE.  See the GNU General Public License
+ *              for more details.
+ *
+ *              You should have received a copy of the GNU General
+ *              Public License along with this program.  If not, see
+ *              <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __INPUT_HPP__
+#define __INPUT_HPP__
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define HAVE_MMAP 1
+#endif
+
+using namespace std;
+
+/* structure used to hand out the input file in blocks; a regular file is
+ * mapped into memory and its blocks point straight into the mapping, while
+ * anything that cannot be mapped (such as a pipe) is read into a buffer one
+ * block at a time */
+struct inputfile
+{
+    const unsigned char * data;    // the mapped file, or NULL
+    size_t size;                   // size of the mapping
+    size_t pos;                    // offset of the next block in the mapping
+    size_t released;               // mapped bytes already given back
+    vector <unsigned char> buffer; // holds the block when the file is not mapped
+    vector <unsigned char> carry;  // bytes given back, which the next block starts with
+    bool   failed;                 // set if reading the file fails
+#ifdef HAVE_MMAP
+    int    fd;
+#else
+    FILE * fp;
+#endif
+};
+
+/* function prototypes */
+bool   openInput(string infilename, inputfile &in);
+bool   getContents(inputfile &in, size_t blockSize, const unsigned char * &block, size_t &n);
+void   ungetContents(inputfile &in, size_t n);
+bool   getAvailable(inputfile &in, size_t most, const unsigned char * &block, size_t &n);
+bool   readWhole(inputfile &in, vector <unsigned char> &contents);
+void   prefetchContents(const unsigned char * block, size_t n);
+void   releaseContents(inputfile &in, const unsigned char * end);
+void   closeInput(inputfile &in);
+
+/* this function will open the input file, mapping it into memory if it is a
+ * regular file; "-" opens standard input, which is mapped too if it is one */
+inline bool openInput(string infilename, inputfile &in)
+{
+    in.data     = NULL;
+    in.size     = 0;
+    in.pos      = 0;
+    in.released = 0;
+    in.failed   = false;
+#ifdef HAVE_MMAP
+    in.fd = infilename == "-" ? dup(STDIN_FILENO) : open(infilename.c_str(), O_RDONLY);
+    if (in.fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(in.fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in.fd, 0);
+        if (map != MAP_FAILED)
+        {
+            in.data = (const unsigned char *)map;
+            in.size = st.st_size;
+            // the file is read front to back, so the kernel can read ahead
+            madvise(map, in.size, MADV_SEQUENTIAL);
+        }
+    }
+#else
+    in.fp = infilename == "-" ? stdin : fopen(infilename.c_str(), "rb");
+    if (in.fp == NULL)
+        return false;
+#endif
+    return true;
+}
+
+/* this function will point block at the next n bytes of the input, at most
+ * blockSize of them, returning false once there is nothing left to read; a
+ * block that had to be read into in.buffer is only valid until the next call,
+ * unless the caller swaps the buffer out for one of its own */
+inline bool getContents(inputfile &in, size_t blockSize, const unsigned char * &block, size_t &n)
+{
+    if (in.data != NULL)
+    {
+        n = min(blockSize, in.size - in.pos);
+        block = in.data + in.pos;
+        in.pos += n;
+        return n > 0;
+    }
+
+    // fill the buffer with large reads until it holds a whole block
+    in.buffer.resize(blockSize);
+    n = min(in.carry.size(), blockSize);
+    if (n > 0)
+        memcpy(&in.buffer[0], &in.carry[0], n);
+    in.carry.erase(in.carry.begin(), in.carry.begin() + n);
+    while (n < blockSize)
+    {
+#ifdef HAVE_MMAP
+        ssize_t got = read(in.fd, &in.buffer[n], blockSize - n);
+        if (got < 0 && errno == EINTR)
+            continue;
+#else
+        long got = fread(&in.buffer[n], 1, blockSize - n, in.fp);
+        if (got == 0 && ferror(in.fp))
+            got = -1;
+#endif
+        if (got < 0)
+        {
+            in.failed = true;
+            return false;
+        }
+        if (got == 0)
+            break;
+        n += got;
+    }
+    in.buffer.resize(n);
+    block = n > 0 ? &in.buffer[0] : NULL;
+    return n > 0;
+}
+
+/* this function will give back the last n bytes of the block getContents last
+ * returned, so that the next block starts with them; a block read into
+ * in.buffer must still be there */
+inline void ungetContents(inputfile &in, size_t n)
+{
+    if (in.data != NULL)
+    {
+        in.pos -= n;
+        return;
+    }
+    in.carry.assign(in.buffer.end() - n, in.buffer.end());
+}
+
+/* this function will point block at whatever part of the input is ready, at
+ * most the next most bytes, returning false once there is nothing left to
+ * read; unlike getContents it makes a single read, so that the bytes of a
+ * pipe or socket are returned as soon as they arrive rather than once a
+ * whole block of them has */
+inline bool getAvailable(inputfile &in, size_t most, const unsigned char * &block, size_t &n)
+{
+    if (in.data != NULL)
+        return getContents(in, most, block, n);
+
+    in.buffer.resize(most);
+#ifdef HAVE_MMAP
+    ssize_t got;
+    do
+        got = read(in.fd, &in.buffer[0], most);
+    while (got < 0 && errno == EINTR);
+#else
+    long got = fread(&in.buffer[0], 1, most, in.fp);
+    if (got == 0 && ferror(in.fp))
+        got = -1;
+#endif
+    if (got < 0)
+        in.failed = true;
+    n = got > 0 ? got : 0;
+    block = n > 0 ? &in.buffer[0] : NULL;
+    return n > 0;
+}
+
+/* this function will read all of the input into contents, for input that is
+ * small enough to be held at once, such as a message */
+inline bool readWhole(inputfile &in, vector <unsigned char> &contents)
+{
+    contents.clear();
+    const unsigned char * block;
+    size_t n;
+    while (getContents(in, 1 << 20, block, n))
+        contents.insert(contents.end(), block, block + n);
+    return !in.failed;
+}
+
+/* this function will touch every page of a mapped block, so that whichever
+ * thread calls it is the one that waits for them to be read from the disk */
+inline void prefetchContents(const unsigned char * block, size_t n)
+{
+#ifdef HAVE_MMAP
+    size_t page = sysconf(_SC_PAGESIZE);
+    volatile unsigned char touched;
+    for (size_t i = 0; i < n; i += page)
+        touched = block[i];
+    (void)touched;
+#endif
+}
+
+/* this function is told when the blocks up to end are done with, so that the
+ * kernel can drop their pages rather than let them count against this process */
+inline void releaseContents(inputfile &in, const unsigned char * end)
+{
+#ifdef HAVE_MMAP
+    if (in.data == NULL)
+        return;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t done = (end - in.data) / page * page;
+    if (done > in.released)
+    {
+        madvise((void *)(in.data + in.released), done - in.released, MADV_DONTNEED);
+        in.released = done;
+    }
+#endif
+}
+
+/* this function will unmap and close the input file */
+inline void closeInput(inputfile &in)
+{
+#ifdef HAVE_MMAP
+    if (in.data != NULL)
+        munmap((void *)in.data, in.size);
+    close(in.fd);
+#else
+    if (in.fp != stdin)
+        fclose(in.fp);
+#endif
+    in.data = NULL;
+}
+
+#endif
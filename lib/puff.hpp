@@ -31,79 +31,1273 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <climits>
+#include <atomic>
+#include "bitio.hpp"
+#include "hufftree.hpp"
+#include "adaptive.hpp"
+#include "huff.hpp"
+#include "threadpool.hpp"
+#include "stats.hpp"
 
 using namespace std;
 typedef unsigned int uint;
 
+/* number of bits used to index the first level of the decoding table; codes
+ * that are longer than this continue into a second-level table */
+const int ROOT_BITS = 11;
+const int SUB_BITS  = 7;
+
+// the stages of extraction timed for --stats
+const int BINREAD_STAGE = 0;
+const int HEADER_STAGE  = 1;
+const int DECODE_STAGE  = 2;
+const int TXTWRITE_STAGE = 3;
+const int NEXTRACT_STAGES = 4;
+const char * const EXTRACT_STAGES[NEXTRACT_STAGES] =
+    { "getBinContents", "readHeader", "decode", "writeTxtFile" };
+
+/* structure used to hold one entry of the decoding lookup table; an entry is
+ * either a decoded character and the number of bits its code uses from the
+ * current level, or a link to a sub-table indexed by the next 'sub' bits */
+struct decodeEntry
+{
+    unsigned short val; // character, or offset of the sub-table
+    unsigned char  len; // bits consumed at this level
+    unsigned char  sub; // width of the linked sub-table, 0 for characters
+};
+
+/* structure used to hold the memory a block is decoded in, so that it is
+ * reused from one block to the next instead of being allocated for each */
+struct decodescratch
+{
+    vector <huffcode> codes;
+    vector <size_t> streamSizes;
+    vector <decodeEntry> table;
+    hufftree tree;
+    // for a context block, the table of each context and the tables themselves
+    unsigned char contextTable[256];
+    vector <decodeEntry> contextTables[MAX_CONTEXT_TABLES];
+    // for an LZ block, the table of distance codes, after that of characters and lengths
+    vector <decodeEntry> distTable;
+    // the codes of the last block with a table of its own, for the blocks that repeat it
+    vector <huffcode> repeatCodes;
+};
+
+/* structure used to hold one block of the binary file while it is decoded */
+struct decodejob
+{
+    uint sizeofBlock;
+    vector <unsigned char> binContents;
+    string decodedText;
+    bool validHeader;
+    bool decoded;
+    decodescratch scratch;
+    huffstats stats; // figures for this block, when --stats is given
+};
+
+/* structure used to hold what the reader thread keeps from one block to the
+ * next as it reads them in order */
+struct blockreader
+{
+    istream * in;
+    unsigned long long blocksLeft; // blocks of the range still to be read
+    unsigned long long blocks;     // blocks read so far
+    bool endOfBlocks;              // set once the block that ends them is read
+    vector <huffcode> repeatCodes; // the table the next block may repeat
+};
+
+/* structure used to hold what the writer thread keeps from one block to the
+ * next as it writes them out in order */
+struct txtwriter
+{
+    ostream * out;
+    string infilename;             // for reporting errors
+    string outfilename;
+    unsigned long long skip;       // characters of the next block before the range
+    unsigned long long rangeLen;   // characters of the range still to be written
+    unsigned long long sizeofFile; // characters decoded so far
+    huffstats * stats;
+    atomic <bool> failed;
+};
+
 /* function prototypes */
-string getBinContents(string infilename);
-string readHeader(string &contents);
-node * rebuildHuffTree(string huffInfo);
-vector <huffcode> regenCodes(node * huffTree);
-string decode(string &contents, vector <huffcode> codes);
-void   writeTxtFile(string &decodedText);
+bool   readIndex(istream &infile, vector <blockindex> &index,
+                 unsigned long long &sizeofFile);
+void   findRepeatCodes(istream &infile, vector <blockindex> &index, size_t first,
+                       vector <huffcode> &codes);
+void   keepCodes(const unsigned char * contents, size_t size, vector <huffcode> &codes);
+void   readBinJob(blockreader * r, decodejob * job, bool withStats);
+void   decodeJob(decodejob * job, bool withStats);
+void   writeTxtJob(txtwriter * w, decodejob * job, future <void> * decoded);
+bool   decodeBlock(const unsigned char * contents, size_t size, char * out, size_t count,
+                   decodescratch &scratch, bool &validHeader, huffstats * stats = NULL);
+bool   getBinContents(istream &infile, uint &sizeofBlock, vector <unsigned char> &contents);
+bool   readHeader(const unsigned char * contents, size_t size, size_t &pos,
+                  vector <huffcode> &codes, vector <size_t> &streamSizes);
+void   readCodeLengths(bitreader &br, int lens[], int nsymbols = 256);
+bool   readStreamTable(bitreader &br, size_t size, size_t &pos, vector <size_t> &streamSizes);
+bool   validCodes(vector <huffcode> &codes);
+bool   readContextHeader(const unsigned char * contents, size_t size, size_t &pos,
+                         decodescratch &scratch, int &longest);
+bool   readLzHeader(const unsigned char * contents, size_t size, size_t &pos,
+                    decodescratch &scratch);
+bool   readTable(bitreader &br, int nsymbols, decodescratch &scratch, vector <decodeEntry> &table);
+void   regenCodes(int lens[], vector <huffcode> &codes, int nsymbols = 256);
+int    rebuildHuffTree(vector <huffcode> &codes, hufftree &tree);
+void   buildDecodeTable(hufftree &tree, vector <decodeEntry> &table);
+int    treeHeight(hufftree &tree, int n);
+void   fillTable(hufftree &tree, int n, int depth, uint code, int bits, size_t base,
+                 vector <decodeEntry> &table);
+bool   decode(const unsigned char * contents, size_t size, size_t pos,
+              const vector <decodeEntry> &table, char * out, size_t count);
+inline char decodeSymbol(bitreader &br, const decodeEntry * t);
+inline uint decodeCode(bitreader &br, const decodeEntry * t);
+template <int N>
+bool   decodeStreams(const unsigned char * contents, size_t pos, vector <size_t> &sizes,
+                     vector <decodeEntry> &table, int longest, char * out, size_t count);
+bool   writeTxtFile(ostream &outfile, string &decodedText, size_t start, size_t n);
+void   extractAdaptive(istream &in, ostream &out, string infilename, string outfilename,
+                       huffstats * stats);
+int    decodeAdaptive(adaptivetree &tree, bitreader &br);
+void   decodeRun(bitreader &br, const decodeEntry * t, int longest, char * out, size_t count);
+int    rebuildDecodeTable(unsigned long long counts[256], int maxCodeLen,
+                          vector <cfreq> &cfreqs, decodescratch &scratch);
+bool   decodeContexts(const unsigned char * contents, size_t pos, vector <size_t> &sizes,
+                      decodescratch &scratch, int longest, char * out, size_t count);
+bool   decodeLz(const unsigned char * contents, size_t size, size_t pos, decodescratch &scratch,
+                char * out, size_t count);
 
-/* this function will read a binary file and rebuild a Huffman tree from the file
- * header, it will then use that tree to decode the encoded text stream and output
- * it to a new plain-text file */
-void huffExtract(string infilename, string outfilename = "out.txt")
+/* this function will read a binary file block by block, rebuilding a Huffman
+ * tree from each block's header, it will then use that tree to decode the
+ * block's encoded text and append it to a new plain-text file; nthreads blocks
+ * are decoded at once, and if rangeLen is given only the rangeLen characters
+ * from rangeStart on are written, decoding just the blocks that hold them; if
+ * stats is given, the time spent in each stage is added to it. A file name
+ * of "-" reads standard input or writes standard output */
+inline void huffExtract(string infilename, string outfilename = "out.txt", int nthreads = 1,
+                        unsigned long long rangeStart = 0, unsigned long long rangeLen = ULLONG_MAX,
+                        huffstats * stats = NULL)
 {
-    // get the binary file contents as a string of 1s and 0s
-    string binContents = getBinContents(infilename);
-    // read in header
-    string huffInfo = readHeader(binContents);
-    // build huffman tree
-    node * huffTree = rebuildHuffTree(huffInfo);
-    // regenerate prefix codes
-    vector <huffcode> codes = regenCodes(huffTree);
-    // read in and decode text
-    string decodedText = decode(binContents, codes);
-    // write decoded text to file
-    writeTxtFile(decodedText);
+    // "-" reads standard input and writes standard output
+    ifstream infile;
+    if (infilename != "-")
+    {
+        infile.open(infilename.c_str(), ios::binary);
+        if (!infile.is_open())
+        {
+            cerr << "Error. Could not open file '" << infilename << "'." << endl;
+            return;
+        }
+    }
+    istream &in = infilename != "-" ? (istream &)infile : cin;
+    // open the output file (over-write any existing contents) through a large buffer
+    ofstream outfile;
+    vector <char> outbuffer(OUTPUT_BUFFER);
+    if (outfilename != "-")
+    {
+        outfile.rdbuf() -> pubsetbuf(&outbuffer[0], outbuffer.size());
+        outfile.open(outfilename.c_str(), ios::binary | ios::trunc);
+        if (!outfile.is_open())
+        {
+            cerr << "Error. Could not open file '" << outfilename << "'." << endl;
+            return;
+        }
+    }
+    ostream &out = outfilename != "-" ? (ostream &)outfile : cout;
+
+    /* the file has to start with the magic bytes; an adaptive binary file
+     * has chunks that can only be decoded in order, and no index */
+    bool whole = rangeStart == 0 && rangeLen == ULLONG_MAX;
+    char magic[sizeof(HUFF_MAGIC)];
+    bool adaptive = in.read(magic, sizeof(magic))
+                    && memcmp(magic, ADAPTIVE_MAGIC, sizeof(magic)) == 0;
+    if (adaptive && !whole)
+    {
+        cerr << "Error. A range cannot be extracted from an adaptive binary file." << endl;
+        return;
+    }
+    if (adaptive)
+    {
+        extractAdaptive(in, out, infilename, outfilename, stats);
+        return;
+    }
+    if (in && memcmp(magic, MESSAGE_MAGIC, sizeof(magic)) == 0)
+    {
+        cerr << "Error. '" << infilename << "' was compressed with a dictionary, "
+             << "which has to be given with --dict." << endl;
+        return;
+    }
+    if (!in || memcmp(magic, HUFF_MAGIC, sizeof(magic)) != 0)
+    {
+        cerr << "Error. '" << infilename << "' is not a valid Huffman binary file." << endl;
+        return;
+    }
+
+    /* a range is found in the index at the end of the file, and decoding starts
+     * from the first block that holds part of it; otherwise every block is
+     * read in order, so the binary file does not have to be seekable */
+    blockreader r;
+    r.in = &in;
+    r.blocksLeft = ULLONG_MAX;
+    r.blocks = 0;
+    r.endOfBlocks = false;
+    r.repeatCodes.clear();
+    unsigned long long skip = 0;
+    if (!whole)
+    {
+        vector <blockindex> index;
+        unsigned long long sizeofFile;
+        if (infilename == "-")
+        {
+            cerr << "Error. A range cannot be extracted from standard input." << endl;
+            return;
+        }
+        if (!readIndex(in, index, sizeofFile))
+        {
+            cerr << "Error. '" << infilename << "' has no valid block index." << endl;
+            return;
+        }
+        if (rangeStart > sizeofFile)
+        {
+            cerr << "Error. The range starts after the end of '" << infilename
+                 << "', which holds " << sizeofFile << " characters." << endl;
+            return;
+        }
+        rangeLen = min(rangeLen, sizeofFile - rangeStart);
+        size_t first = 0;
+        unsigned long long blockStart = 0;
+        while (first < index.size() && blockStart + index[first].sizeofBlock <= rangeStart)
+            blockStart += index[first++].sizeofBlock;
+        skip = rangeStart - blockStart;
+        r.blocksLeft = 0;
+        for (size_t i = first; i < index.size() && blockStart < rangeStart + rangeLen; i++)
+        {
+            blockStart += index[i].sizeofBlock;
+            r.blocksLeft++;
+        }
+        if (r.blocksLeft > 0)
+        {
+            findRepeatCodes(in, index, first, r.repeatCodes);
+            in.seekg(index[first].offset);
+        }
+    }
+
+    /* the work is split into a pipeline the way huffCompress splits it: a
+     * reader thread reads blocks ahead, they are decoded on this thread or on
+     * the worker threads, and a writer thread writes them out in order; the
+     * jobs are reused in turn, so only a few blocks of the binary file and of
+     * the plain-text are held at a time */
+    threadpool reader, writer, pool;
+    startPool(reader, 1);
+    startPool(writer, 1);
+    if (nthreads > 1)
+        startPool(pool, nthreads);
+    size_t ahead  = nthreads;
+    size_t behind = nthreads > 1 ? nthreads * BLOCKS_PER_THREAD : 1;
+    size_t window = ahead + 1 + behind;
+    vector <decodejob> jobs(window);
+    vector < future <void> > readDone(window), decodeDone(window), writeDone(window);
+    txtwriter w;
+    w.out = &out;
+    w.infilename = infilename;
+    w.outfilename = outfilename;
+    w.skip = skip;
+    w.rangeLen = rangeLen;
+    w.sizeofFile = 0;
+    w.stats = stats;
+    w.failed = false;
+
+    for (size_t k = 0; k <= ahead; k++)
+        readDone[k] = submitTask(reader, bind(readBinJob, &r, &jobs[k], stats != NULL));
+    for (unsigned long long k = 0; ; k++)
+    {
+        // decode the next block once it has been read
+        size_t slot = k % window;
+        decodejob &job = jobs[slot];
+        readDone[slot].get();
+        if (job.sizeofBlock == 0 || w.failed)
+            break;
+        if (nthreads > 1)
+            decodeDone[slot] = submitTask(pool, bind(decodeJob, &job, stats != NULL));
+        else
+            decodeJob(&job, stats != NULL);
+        writeDone[slot] = submitTask(writer, bind(writeTxtJob, &w, &job, &decodeDone[slot]));
+
+        // the reader gets the job of the oldest block once it has been written
+        size_t next = (k + ahead + 1) % window;
+        if (writeDone[next].valid())
+            writeDone[next].get();
+        readDone[next] = submitTask(reader, bind(readBinJob, &r, &jobs[next], stats != NULL));
+    }
+    // wait for the blocks read past the end, and for the last ones to be written
+    for (size_t i = 0; i < window; i++)
+    {
+        if (readDone[i].valid())
+            readDone[i].get();
+        if (writeDone[i].valid())
+            writeDone[i].get();
+    }
+    stopPool(reader);
+    stopPool(writer);
+    if (nthreads > 1)
+        stopPool(pool);
+    if (!w.failed && !out.flush())
+    {
+        cerr << "Error while writing file '" << outfilename << "'." << endl;
+        return;
+    }
+    if (w.failed || !whole)
+        return;
+
+    /* the blocks are followed by their index, which is not needed when reading
+     * them in order, then the number of blocks and the length of the whole
+     * file, which have to match */
+    unsigned long long expectedBlocks = 0, expected = 0;
+    if (r.endOfBlocks)
+        in.ignore(r.blocks * (sizeof(unsigned long long) + 2 * sizeof(uint)));
+    if (!r.endOfBlocks || !in.read((char *)&expectedBlocks, sizeof(expectedBlocks))
+        || !in.read((char *)&expected, sizeof(expected))
+        || expectedBlocks != r.blocks || expected != w.sizeofFile)
+        cerr << "Error. '" << infilename << "' is truncated or could not be read." << endl;
 }
 
-/* this function will get the contents of the binary file and save to a 
- * string of 1s and 0s */
-string getBinContents(string infilename)
+/* this function will read the next block of the binary file into a job, as a
+ * task on the reader thread, leaving the job with no characters once the end
+ * of the blocks, or of the range, is reached */
+inline void readBinJob(blockreader * r, decodejob * job, bool withStats)
 {
-    string binContents = "";
-    return binContents;
+    huffstats * stats = withStats ? &job -> stats : NULL;
+    stagetimer timer = { 0, 0 };
+    if (stats)
+        initStats(job -> stats, EXTRACT_STAGES, NEXTRACT_STAGES);
+    startStage(stats, timer);
+    bool more = r -> blocksLeft > 0
+                && getBinContents(*r -> in, job -> sizeofBlock, job -> binContents)
+                && job -> sizeofBlock > 0;
+    if (!more)
+    {
+        // the end of the range, or of the blocks
+        if (r -> blocksLeft > 0)
+            r -> endOfBlocks = r -> in -> good();
+        r -> blocksLeft = 0;
+        job -> sizeofBlock = 0;
+        return;
+    }
+    endStage(stats, BINREAD_STAGE, timer);
+    if (stats)
+    {
+        stats -> bytesIn = 2 * sizeof(uint) + job -> binContents.size();
+        stats -> blocks = 1;
+    }
+    r -> blocksLeft--;
+    r -> blocks++;
+    // a block that repeats a table is given it, as it is decoded apart from the one with it
+    job -> scratch.repeatCodes = r -> repeatCodes;
+    keepCodes(job -> binContents.size() ? &job -> binContents[0] : NULL, job -> binContents.size(),
+              r -> repeatCodes);
 }
 
-/* this function will extract the header from the file */
-string readHeader(string &contents)
+/* this function will write the part of a job's block that is inside the range
+ * to the plain-text file once it has been decoded, as a task on the writer
+ * thread, which writes the blocks in the order they were read; a block that
+ * cannot be decoded stops the extraction */
+inline void writeTxtJob(txtwriter * w, decodejob * job, future <void> * decoded)
 {
-    string header = "";
-    return header;
+    if (decoded -> valid())
+        decoded -> get();
+    if (w -> failed)
+        return;
+    if (!job -> validHeader)
+    {
+        cerr << "Error. '" << w -> infilename << "' is not a valid Huffman binary file." << endl;
+        w -> failed = true;
+        return;
+    }
+    if (!job -> decoded)
+    {
+        cerr << "Error. '" << w -> infilename << "' is truncated or corrupt." << endl;
+        w -> failed = true;
+        return;
+    }
+    huffstats * stats = w -> stats ? &job -> stats : NULL;
+    stagetimer timer = { 0, 0 };
+    startStage(stats, timer);
+    // only the part of the block inside the range is written
+    unsigned long long n = min((unsigned long long)job -> sizeofBlock - w -> skip, w -> rangeLen);
+    if (!writeTxtFile(*w -> out, job -> decodedText, w -> skip, n))
+    {
+        cerr << "Error while writing file '" << w -> outfilename << "'." << endl;
+        w -> failed = true;
+        return;
+    }
+    if (stats)
+    {
+        endStage(stats, TXTWRITE_STAGE, timer);
+        stats -> bytesOut = n;
+        mergeStats(*w -> stats, *stats);
+    }
+    w -> skip = 0;
+    w -> rangeLen -= n;
+    w -> sizeofFile += job -> sizeofBlock;
 }
 
-/* this function will use the extracted header to rebuild a Huffman tree */
-node * rebuildHuffTree(string huffInfo)
+/* this function will read the index of blocks from the end of the binary file,
+ * returning false unless the blocks it describes follow one another from the
+ * magic bytes to the index and add up to sizeofFile characters */
+inline bool readIndex(istream &infile, vector <blockindex> &index,
+                      unsigned long long &sizeofFile)
 {
-    node * huffTree = createNode(-1, false);
-    return huffTree;
+    const unsigned long long entrySize = sizeof(unsigned long long) + 2 * sizeof(uint);
+    unsigned long long nblocks;
+    if (!infile.seekg(0, ios::end))
+        return false;
+    unsigned long long fileSize = infile.tellg();
+    if (fileSize < sizeof(HUFF_MAGIC) + sizeof(uint) + 2 * sizeof(unsigned long long))
+        return false;
+    infile.seekg(fileSize - 2 * sizeof(unsigned long long));
+    if (!infile.read((char *)&nblocks, sizeof(nblocks))
+        || !infile.read((char *)&sizeofFile, sizeof(sizeofFile)))
+        return false;
+    unsigned long long indexStart = fileSize - 2 * sizeof(unsigned long long);
+    if (nblocks > (indexStart - sizeof(HUFF_MAGIC) - sizeof(uint)) / entrySize)
+        return false;
+    indexStart -= nblocks * entrySize;
+
+    infile.seekg(indexStart);
+    index.resize(nblocks);
+    unsigned long long offset = sizeof(HUFF_MAGIC);
+    unsigned long long total = 0;
+    for (size_t i = 0; i < index.size(); i++)
+    {
+        infile.read((char *)&index[i].offset, sizeof(index[i].offset));
+        infile.read((char *)&index[i].sizeofBlock, sizeof(index[i].sizeofBlock));
+        infile.read((char *)&index[i].sizeofText, sizeof(index[i].sizeofText));
+        if (!infile || index[i].offset != offset || index[i].sizeofBlock == 0)
+            return false;
+        offset += 2 * sizeof(uint) + index[i].sizeofText;
+        total += index[i].sizeofBlock;
+    }
+    // the blocks are followed by the end marker and then the index
+    return offset + sizeof(uint) == indexStart && total == sizeofFile;
 }
 
-/* this function will use the rebuild Huffman tree to generate the prefix codes
- * for each character that should be in the plain-text file */
-vector <huffcode> regenCodes(node * huffTree)
+/* this function will find the table that the block first of the index, where
+ * a range starts, may repeat, from the headers of the blocks before it; only
+ * a block up to MAX_REPEATS back can hold it, and codes is left empty if none
+ * does */
+inline void findRepeatCodes(istream &infile, vector <blockindex> &index, size_t first,
+                            vector <huffcode> &codes)
 {
-    vector <huffcode> codes;
-    return codes;
+    // the type byte, and no more than 9 bits for each character's code length
+    const size_t mostHeader = 1 + 256 * 9 / 8;
+    vector <unsigned char> header;
+    codes.clear();
+    for (size_t back = 1; back <= (size_t)MAX_REPEATS && back <= first; back++)
+    {
+        blockindex &entry = index[first - back];
+        header.resize(min((size_t)entry.sizeofText, mostHeader));
+        infile.seekg(entry.offset + 2 * sizeof(uint));
+        if (header.empty() || !infile.read((char *)&header[0], header.size()))
+            return;
+        if (header[0] == HUFFMAN_BLOCK)
+        {
+            keepCodes(&header[0], header.size(), codes);
+            return;
+        }
+    }
+}
+
+/* this function will regenerate the codes of a block from its header if it
+ * has a table of its own, for the blocks after it that repeat it, leaving
+ * codes as they were otherwise; the header is only checked when the block
+ * itself is decoded */
+inline void keepCodes(const unsigned char * contents, size_t size, vector <huffcode> &codes)
+{
+    if (size == 0 || contents[0] != HUFFMAN_BLOCK)
+        return;
+    bitreader br;
+    initReader(br, contents + 1, size - 1);
+    int lens[256];
+    readCodeLengths(br, lens);
+    regenCodes(lens, codes);
 }
 
-/* this function will decode the encoded text stream from the file and return
- * the plain-text */
-string decode(string &contents, vector <huffcode> codes)
+/* this function will decode one block of a job, as a task on a worker thread
+ * or directly when there is only one thread, timing it into the job's own
+ * stats if withStats is set */
+inline void decodeJob(decodejob * job, bool withStats)
 {
-    string decodedText = "";
-    return decodedText;
+    vector <unsigned char> &bin = job -> binContents;
+    job -> decodedText.resize(job -> sizeofBlock);
+    job -> decoded = decodeBlock(bin.size() ? &bin[0] : NULL, bin.size(), &job -> decodedText[0],
+                                 job -> sizeofBlock, job -> scratch, job -> validHeader,
+                                 withStats ? &job -> stats : NULL);
 }
 
-/* this function will open a file (over-write any existing contents) and write
- * the decoded text to it */
-void writeTxtFile(string &decodedText)
+/* this function will decode the size bytes of a block's header and encoded
+ * text into the count characters at out, working in the memory of scratch;
+ * validHeader is cleared if the header is not one huffCompress could have
+ * written, and it returns false if the block could not be decoded. Each
+ * stage is timed into stats if given */
+inline bool decodeBlock(const unsigned char * contents, size_t size, char * out, size_t count,
+                        decodescratch &scratch, bool &validHeader, huffstats * stats)
 {
+    stagetimer timer = { 0, 0 };
+    startStage(stats, timer);
+    // the first byte says how the block is coded
+    validHeader = size > 0 && contents[0] <= REPEAT_BLOCK;
+    if (!validHeader)
+        return false;
+    // a stored block is the characters themselves, and an RLE block one character
+    if (contents[0] == STORED_BLOCK || contents[0] == RLE_BLOCK)
+    {
+        validHeader = contents[0] == STORED_BLOCK ? size == 1 + count : size == 2;
+        if (!validHeader)
+            return false;
+        if (contents[0] == STORED_BLOCK)
+            memcpy(out, contents + 1, count);
+        else
+            memset(out, contents[1], count);
+        endStage(stats, DECODE_STAGE, timer);
+        return true;
+    }
+    size_t pos = 1;
+    vector <size_t> &streamSizes = scratch.streamSizes;
+    if (contents[0] == LZ_BLOCK)
+    {
+        validHeader = readLzHeader(contents, size, pos, scratch);
+        if (!validHeader)
+            return false;
+        endStage(stats, HEADER_STAGE, timer);
+        bool decoded = decodeLz(contents, size, pos, scratch, out, count);
+        endStage(stats, DECODE_STAGE, timer);
+        return decoded;
+    }
+    if (contents[0] == CONTEXT_BLOCK)
+    {
+        int longest;
+        validHeader = readContextHeader(contents, size, pos, scratch, longest);
+        if (!validHeader)
+            return false;
+        endStage(stats, HEADER_STAGE, timer);
+        bool decoded = decodeContexts(contents, pos, streamSizes, scratch, longest, out, count);
+        endStage(stats, DECODE_STAGE, timer);
+        return decoded;
+    }
+
+    /* read in header and regenerate the prefix codes from it, or take those of
+     * the last block with a table of its own, which the next blocks may repeat */
+    vector <huffcode> &codes = scratch.codes;
+    if (contents[0] == REPEAT_BLOCK)
+    {
+        bitreader br;
+        initReader(br, contents + pos, size - pos);
+        codes = scratch.repeatCodes;
+        validHeader = !codes.empty() && validCodes(codes)
+                      && readStreamTable(br, size, pos, streamSizes);
+    }
+    else
+    {
+        validHeader = readHeader(contents, size, pos, codes, streamSizes);
+        scratch.repeatCodes = codes;
+    }
+    if (!validHeader)
+        return false;
+    // build the huffman tree, and turn it into a lookup table
+    rebuildHuffTree(codes, scratch.tree);
+    vector <decodeEntry> &table = scratch.table;
+    buildDecodeTable(scratch.tree, table);
+    int longest = 0;
+    for (size_t i = 0; i < codes.size(); i++)
+        longest = max(longest, codes[i].len);
+    endStage(stats, HEADER_STAGE, timer);
+    // read in and decode text, reading interleaved streams side by side
+    bool decoded = false;
+    switch (streamSizes.size())
+    {
+        case 1:
+            decoded = decode(contents, size, pos, table, out, count);
+            break;
+        case 2:
+            decoded = decodeStreams<2>(contents, pos, streamSizes, table, longest, out, count);
+            break;
+        case 4:
+            decoded = decodeStreams<4>(contents, pos, streamSizes, table, longest, out, count);
+            break;
+        case 8:
+            decoded = decodeStreams<8>(contents, pos, streamSizes, table, longest, out, count);
+            break;
+    }
+    endStage(stats, DECODE_STAGE, timer);
+    return decoded;
+}
+
+/* this function will get the next block of the binary file: the number of
+ * characters it decodes to, and its code lengths and encoded text as a vector
+ * of bytes; a block of no characters marks the end of the blocks, and it
+ * returns false if the block is cut off */
+inline bool getBinContents(istream &infile, uint &sizeofBlock, vector <unsigned char> &contents)
+{
+    uint sizeofText = 0;
+    if (!infile.read((char *)&sizeofBlock, sizeof(sizeofBlock)))
+        return false;
+    if (sizeofBlock == 0)
+        return true;
+    if (!infile.read((char *)&sizeofText, sizeof(sizeofText)))
+        return false;
+
+    contents.resize(sizeofText);
+    if (sizeofText > 0)
+        infile.read((char *)&contents[0], sizeofText);
+    return infile.good();
+}
+
+/* this function will extract the code lengths and stream table from the
+ * block header, written by writeCodeLengths and writeStreamTable, and
+ * regenerate the codes from them, leaving pos at the start of the first stream */
+inline bool readHeader(const unsigned char * contents, size_t size, size_t &pos,
+                       vector <huffcode> &codes, vector <size_t> &streamSizes)
+{
+    bitreader br;
+    initReader(br, size > pos ? contents + pos : NULL, size - pos);
+    int lens[256];
+    readCodeLengths(br, lens);
+    if (!readStreamTable(br, size, pos, streamSizes))
+        return false;
+    regenCodes(lens, codes);
+    return validCodes(codes);
+}
+
+/* this function will read the length of every character's code, as
+ * writeCodeLengths wrote them for an alphabet of nsymbols symbols */
+inline void readCodeLengths(bitreader &br, int lens[], int nsymbols)
+{
+    int i = 0;
+    while (i < nsymbols)
+    {
+        refill(br);
+        int len = peekBits(br, 4);
+        if (len)
+        {
+            consumeBits(br, 4);
+            lens[i++] = len;
+            continue;
+        }
+        // a run of characters with no code
+        int run = peekBits(br, 9) + 1;
+        consumeBits(br, 9);
+        for (int j = 0; j < run && i < nsymbols; j++)
+            lens[i++] = 0;
+    }
+}
+
+/* this function will read the stream table that ends the header, moving pos,
+ * where the header started, on to the first stream; the stream table gives
+ * the size of every stream but the last, which takes the rest of the size
+ * bytes of the block, and streams are only ever split 1, 2, 4 or 8 ways */
+inline bool readStreamTable(bitreader &br, size_t size, size_t &pos, vector <size_t> &streamSizes)
+{
+    refill(br);
+    int nstreams = peekBits(br, 4) + 1;
+    consumeBits(br, 4);
+    if (nstreams & (nstreams - 1))
+        return false;
+    streamSizes.resize(nstreams);
+    for (int s = 0; s + 1 < nstreams; s++)
+    {
+        refill(br);
+        streamSizes[s] = peekBits(br, 32);
+        consumeBits(br, 32);
+    }
+
+    // ran out of header, the file is truncated
+    size_t headerBytes = (bitsRead(br) + 7) / 8;
+    if (headerBytes > size - pos)
+        return false;
+    pos += headerBytes;
+    size_t rest = size - pos;
+    for (int s = 0; s + 1 < nstreams; s++)
+    {
+        if (streamSizes[s] > rest)
+            return false;
+        rest -= streamSizes[s];
+    }
+    streamSizes[nstreams - 1] = rest;
+    return true;
+}
+
+/* this function will check that the codes fill the code space exactly, unless
+ * there is a single character with a code of one bit */
+inline bool validCodes(vector <huffcode> &codes)
+{
+    unsigned long kraft = 0;
+    for (size_t i = 0; i < codes.size(); i++)
+        kraft += 1ul << (MAX_CODE_LEN - codes[i].len);
+    if (codes.size() == 1)
+        return codes[0].len == 1;
+    return kraft == (1ul << MAX_CODE_LEN);
+}
+
+/* this function will read the header of a context block, written by
+ * writeContextTables and writeStreamTable, building the decoding table of
+ * every group of contexts and finding the longest code of any of them */
+inline bool readContextHeader(const unsigned char * contents, size_t size, size_t &pos,
+                              decodescratch &scratch, int &longest)
+{
+    bitreader br;
+    initReader(br, size > pos ? contents + pos : NULL, size - pos);
+    refill(br);
+    int ntables = peekBits(br, 4) + 1;
+    consumeBits(br, 4);
+    int t = 0;
+    for (int p = 0; p < 256; p++)
+    {
+        refill(br);
+        if (peekBits(br, 1))
+        {
+            t = peekBits(br, 5) & 15;
+            consumeBits(br, 5);
+            if (t >= ntables)
+                return false;
+        }
+        else
+            consumeBits(br, 1);
+        scratch.contextTable[p] = t;
+    }
+
+    longest = 0;
+    for (t = 0; t < ntables; t++)
+    {
+        int lens[256];
+        readCodeLengths(br, lens);
+        regenCodes(lens, scratch.codes);
+        if (!validCodes(scratch.codes))
+            return false;
+        rebuildHuffTree(scratch.codes, scratch.tree);
+        buildDecodeTable(scratch.tree, scratch.contextTables[t]);
+        for (size_t i = 0; i < scratch.codes.size(); i++)
+            longest = max(longest, scratch.codes[i].len);
+    }
+    return readStreamTable(br, size, pos, scratch.streamSizes);
+}
+
+/* this function will read the header of an LZ block, written by writeLzTables
+ * and writeStreamTable, building the decoding tables for the characters and
+ * lengths and for the distances; an LZ block is always a single stream */
+inline bool readLzHeader(const unsigned char * contents, size_t size, size_t &pos,
+                         decodescratch &scratch)
+{
+    bitreader br;
+    initReader(br, size > pos ? contents + pos : NULL, size - pos);
+    if (!readTable(br, LITLEN_SYMBOLS, scratch, scratch.table)
+        || !readTable(br, DIST_CODES, scratch, scratch.distTable))
+        return false;
+    return readStreamTable(br, size, pos, scratch.streamSizes) && scratch.streamSizes.size() == 1;
+}
+
+/* this function will read the code lengths of an alphabet of nsymbols
+ * symbols and turn the codes into a decoding table */
+inline bool readTable(bitreader &br, int nsymbols, decodescratch &scratch, vector <decodeEntry> &table)
+{
+    int lens[MAX_SYMBOLS];
+    readCodeLengths(br, lens, nsymbols);
+    regenCodes(lens, scratch.codes, nsymbols);
+    if (!validCodes(scratch.codes))
+        return false;
+    rebuildHuffTree(scratch.codes, scratch.tree);
+    buildDecodeTable(scratch.tree, table);
+    return true;
+}
+
+/* this function will regenerate the canonical prefix code for each of the
+ * nsymbols characters that has a code length, exactly the way huffCompress
+ * assigned them */
+inline void regenCodes(int lens[], vector <huffcode> &codes, int nsymbols)
+{
+    codes.clear();
+    for (int i = 0; i < nsymbols; i++)
+    {
+        if (lens[i])
+        {
+            huffcode ccode;
+            ccode.c = i;
+            ccode.code = 0;
+            ccode.len = lens[i];
+            codes.push_back(ccode);
+        }
+    }
+    canonicalCodes(codes);
+}
+
+/* this function will rebuild the Huffman tree that the codes describe, by
+ * following each code from the root and adding the nodes along its path,
+ * returning the root; the codes are complete, so there are never more than
+ * 2 nodes per code */
+inline int rebuildHuffTree(vector <huffcode> &codes, hufftree &tree)
+{
+    resetTree(tree);
+    tree.root = createNode(tree, 0, false);
+    for (int i = 0; i < (int)codes.size(); i++)
+    {
+        int n = tree.root;
+        for (int b = codes[i].len - 1; b >= 0; b--)
+        {
+            unsigned short &child = ((codes[i].code >> b) & 1) ? tree.nodes[n].right
+                                                               : tree.nodes[n].left;
+            if (child == NO_NODE)
+                child = createNode(tree, 0, b == 0);
+            n = child;
+        }
+        tree.nodes[n].c = codes[i].c;
+    }
+    return tree.root;
+}
+
+/* this function will use the rebuilt Huffman tree to generate a lookup table
+ * indexed by the next ROOT_BITS bits of the encoded text, so that every lookup
+ * yields a whole character instead of walking the tree one bit at a time; the
+ * sub-tables follow it in the same vector */
+inline void buildDecodeTable(hufftree &tree, vector <decodeEntry> &table)
+{
+    table.resize(1 << ROOT_BITS);
+    fillTable(tree, tree.root, 0, 0, ROOT_BITS, 0, table);
+}
+
+/* this function will find the length of the longest path from node n to a leaf */
+inline int treeHeight(hufftree &tree, int n)
+{
+    if (n == NO_NODE || tree.nodes[n].isLeaf)
+        return 0;
+    return 1 + max(treeHeight(tree, tree.nodes[n].left), treeHeight(tree, tree.nodes[n].right));
+}
+
+/* this function will recurse through the tree filling the table that starts at
+ * base with every code found in the first 'bits' levels below node n; when a
+ * code is longer than that, a sub-table is started for the rest of the code.
+ * The only tree with a missing child is that of a single character, whose
+ * unused code never occurs in the encoded text */
+inline void fillTable(hufftree &tree, int n, int depth, uint code, int bits, size_t base,
+                      vector <decodeEntry> &table)
+{
+    if (n == NO_NODE || tree.nodes[n].isLeaf)
+    {
+        /* a code shorter than the index width matches every index that
+         * starts with it, so fill all of them */
+        int  pad   = bits - depth;
+        uint first = code << pad;
+        for (uint i = 0; i < (1u << pad); i++)
+        {
+            table[base + first + i].val = n != NO_NODE ? tree.nodes[n].c : 0;
+            table[base + first + i].len = depth;
+            table[base + first + i].sub = 0;
+        }
+        return;
+    }
+    if (depth == bits)
+    {
+        // the rest of this subtree goes into a sub-table of its own
+        int    subBits = min(treeHeight(tree, n), SUB_BITS);
+        size_t offset  = table.size();
+        table.resize(offset + (1 << subBits));
+        table[base + code].val = offset;
+        table[base + code].len = bits;
+        table[base + code].sub = subBits;
+        fillTable(tree, n, 0, 0, subBits, offset, table);
+        return;
+    }
+    fillTable(tree, tree.nodes[n].left,  depth + 1, code << 1,       bits, base, table);
+    fillTable(tree, tree.nodes[n].right, depth + 1, (code << 1) | 1, bits, base, table);
+}
+
+/* this function will decode count characters from the encoded text, which
+ * runs from pos to the end of the size bytes of contents, into out, returning
+ * false if the encoded text ran out first */
+inline bool decode(const unsigned char * contents, size_t size, size_t pos,
+                   const vector <decodeEntry> &table, char * out, size_t count)
+{
+    size_t textBytes = size - pos;
+    bitreader br;
+    initReader(br, textBytes ? contents + pos : NULL, textBytes);
+
+    const decodeEntry * t = &table[0];
+    char * outEnd = out + count;
+    while (out < outEnd)
+    {
+        /* a refill leaves at least 56 bits, which is enough to decode five
+         * codes that fit in the first level before refilling again */
+        refill(br);
+        int n = (int)min(outEnd - out, (ptrdiff_t)5);
+        for (int k = 0; k < n; k++)
+        {
+            const decodeEntry * e = &t[peekBits(br, ROOT_BITS)];
+            // follow links to sub-tables until a character is found
+            if (e -> sub)
+            {
+                while (e -> sub)
+                {
+                    consumeBits(br, e -> len);
+                    refill(br);
+                    e = &t[e -> val + peekBits(br, e -> sub)];
+                }
+                n = k + 1;
+            }
+            consumeBits(br, e -> len);
+            *out++ = (char)e -> val;
+        }
+    }
+
+    return bitsRead(br) <= (unsigned long long)textBytes * 8;
+}
+
+/* this function will decode one character, following links to sub-tables
+ * until the whole code has been read; the caller makes sure the whole code is
+ * already in the bit reader */
+inline char decodeSymbol(bitreader &br, const decodeEntry * t)
+{
+    return (char)decodeCode(br, t);
+}
+
+/* this function will decode one symbol the way decodeSymbol decodes a
+ * character, for alphabets of more than 256 symbols */
+inline uint decodeCode(bitreader &br, const decodeEntry * t)
+{
+    const decodeEntry * e = &t[peekBits(br, ROOT_BITS)];
+    while (e -> sub)
+    {
+        consumeBits(br, e -> len);
+        e = &t[e -> val + peekBits(br, e -> sub)];
+    }
+    consumeBits(br, e -> len);
+    return e -> val;
+}
+
+/* this function will decode count characters that were split round robin into
+ * N streams, the first of which starts at pos; one character is taken from each
+ * stream in turn, so the N lookups do not wait on one another the way the
+ * codes of a single stream do */
+template <int N>
+bool decodeStreams(const unsigned char * contents, size_t pos, vector <size_t> &sizes,
+                   vector <decodeEntry> &table, int longest, char * out, size_t count)
+{
+    bitreader br[N];
+    for (int s = 0; s < N; s++)
+    {
+        initReader(br[s], sizes[s] ? contents + pos : NULL, sizes[s]);
+        pos += sizes[s];
+    }
+
+    /* a refill leaves at least 56 bits, which is enough for this many codes of
+     * the longest length, however they are split between the table levels */
+    const decodeEntry * t = &table[0];
+    size_t batch  = 56 / max(longest, 1);
+    size_t rounds = count / N;
+    while (rounds > 0)
+    {
+#pragma GCC unroll 8
+        for (int s = 0; s < N; s++)
+            refill(br[s]);
+        size_t n = min(rounds, batch);
+        // unrolling over the streams keeps every bit reader in registers
+        for (size_t k = 0; k < n; k++)
+        {
+#pragma GCC unroll 8
+            for (int s = 0; s < N; s++)
+                out[s] = decodeSymbol(br[s], t);
+            out += N;
+        }
+        rounds -= n;
+    }
+    // the characters left over come from the first streams
+    for (size_t s = 0; s < count % N; s++)
+    {
+        refill(br[s]);
+        *out++ = decodeSymbol(br[s], t);
+    }
+
+    for (int s = 0; s < N; s++)
+        if (bitsRead(br[s]) > (unsigned long long)sizes[s] * 8)
+            return false;
+    return true;
+}
+
+/* this function will write n characters of a block of decoded text, from start
+ * on, to the output file */
+inline bool writeTxtFile(ostream &outfile, string &decodedText, size_t start, size_t n)
+{
+    outfile.write(decodedText.data() + start, n);
+    return outfile.good();
+}
+
+/* this function will extract an adaptive binary file, which follows its magic
+ * bytes, chunk by chunk, changing the codes after each character or every so
+ * many characters exactly as huffCompressAdaptive did; each chunk is written
+ * out as soon as it is decoded, so the plain-text keeps up with a binary file
+ * that is still being written */
+inline void extractAdaptive(istream &in, ostream &out, string infilename, string outfilename,
+                            huffstats * stats)
+{
+    uint interval = 0, maxCodeLen = 0;
+    in.read((char *)&interval, sizeof(interval));
+    in.read((char *)&maxCodeLen, sizeof(maxCodeLen));
+    if (!in || (interval && interval < MIN_REBUILD_INTERVAL) || interval > MAX_REBUILD_INTERVAL
+        || maxCodeLen < 8 || maxCodeLen > MAX_CODE_LEN)
+    {
+        cerr << "Error. '" << infilename << "' is not a valid Huffman binary file." << endl;
+        return;
+    }
+
+    adaptivetree tree;
+    initAdaptiveTree(tree);
+    unsigned long long counts[256];
+    vector <cfreq> cfreqs;
+    decodescratch scratch;
+    size_t sinceRebuild = 0;
+    int longest = 0;
+    if (interval)
+    {
+        for (int c = 0; c < 256; c++)
+            counts[c] = 1;
+        longest = rebuildDecodeTable(counts, maxCodeLen, cfreqs, scratch);
+    }
+
+    vector <unsigned char> binContents;
+    string decodedText;
+    unsigned long long sizeofFile = 0;
+    stagetimer timer = { 0, 0 };
+    startStage(stats, timer);
+    while (true)
+    {
+        uint sizeofChunk;
+        if (!getBinContents(in, sizeofChunk, binContents))
+        {
+            cerr << "Error. '" << infilename << "' is truncated or could not be read." << endl;
+            return;
+        }
+        if (sizeofChunk == 0)
+            break;
+        endStage(stats, BINREAD_STAGE, timer);
+
+        bitreader br;
+        initReader(br, binContents.size() ? &binContents[0] : NULL, binContents.size());
+        decodedText.resize(sizeofChunk);
+        char * text = &decodedText[0];
+        bool corrupt = false;
+        if (interval == 0)
+        {
+            for (size_t i = 0; i < sizeofChunk && !corrupt; i++)
+            {
+                int c = decodeAdaptive(tree, br);
+                corrupt = c < 0;
+                text[i] = (char)c;
+            }
+        }
+        else
+        {
+            // decode up to the next rebuild with the codes as they are
+            size_t i = 0;
+            while (i < sizeofChunk)
+            {
+                size_t m = min(sizeofChunk - i, interval - sinceRebuild);
+                decodeRun(br, &scratch.table[0], longest, text + i, m);
+                countBytes((unsigned char *)text + i, m, counts);
+                i += m;
+                sinceRebuild += m;
+                if (sinceRebuild == interval)
+                {
+                    endStage(stats, DECODE_STAGE, timer);
+                    longest = rebuildDecodeTable(counts, maxCodeLen, cfreqs, scratch);
+                    sinceRebuild = 0;
+                    endStage(stats, HEADER_STAGE, timer);
+                }
+            }
+        }
+        endStage(stats, DECODE_STAGE, timer);
+        if (corrupt || bitsRead(br) > (unsigned long long)binContents.size() * 8)
+        {
+            cerr << "Error. '" << infilename << "' is truncated or corrupt." << endl;
+            return;
+        }
+
+        if (!writeTxtFile(out, decodedText, 0, sizeofChunk) || !out.flush())
+        {
+            cerr << "Error while writing file '" << outfilename << "'." << endl;
+            return;
+        }
+        sizeofFile += sizeofChunk;
+        if (stats)
+        {
+            stats -> bytesIn += 2 * sizeof(uint) + binContents.size();
+            stats -> bytesOut += sizeofChunk;
+            stats -> blocks++;
+        }
+        endStage(stats, TXTWRITE_STAGE, timer);
+    }
+
+    // the chunks are followed by the number of characters in all of them
+    unsigned long long expected = 0;
+    if (!in.read((char *)&expected, sizeof(expected)) || expected != sizeofFile)
+        cerr << "Error. '" << infilename << "' is truncated or could not be read." << endl;
+}
+
+/* this function will decode one character with the adaptive tree, following
+ * the code bit by bit from the root, and then update the tree; it returns -1
+ * if the code for characters not yet seen is followed by one that has been,
+ * which the compressor never writes */
+inline int decodeAdaptive(adaptivetree &tree, bitreader &br)
+{
+    int n = ADAPTIVE_ROOT;
+    while (tree.nodes[n].c == NO_CHAR)
+    {
+        if (br.nbits < 8)
+            refill(br);
+        n = peekBits(br, 1) ? tree.nodes[n].right : tree.nodes[n].left;
+        consumeBits(br, 1);
+    }
+    int c = tree.nodes[n].c;
+    if (c == NOT_YET_SEEN)
+    {
+        refill(br);
+        c = peekBits(br, 8);
+        consumeBits(br, 8);
+        if (tree.leaf[c] != NO_ADAPTIVE_NODE)
+            return -1;
+    }
+    updateAdaptiveTree(tree, c);
+    return c;
+}
+
+/* this function will decode count characters from a single stream into out,
+ * refilling the bit reader once for as many codes of the longest length as it
+ * is sure to hold */
+inline void decodeRun(bitreader &br, const decodeEntry * t, int longest, char * out, size_t count)
+{
+    size_t batch = 56 / max(longest, 1);
+    while (count > 0)
+    {
+        refill(br);
+        size_t n = min(count, batch);
+        for (size_t k = 0; k < n; k++)
+            *out++ = decodeSymbol(br, t);
+        count -= n;
+    }
+}
+
+/* this function will rebuild the codes from the counts exactly the way
+ * huffCompressAdaptive did, and turn them into a decoding table, returning
+ * the length of the longest code */
+inline int rebuildDecodeTable(unsigned long long counts[256], int maxCodeLen,
+                              vector <cfreq> &cfreqs, decodescratch &scratch)
+{
+    rebuildCodes(counts, maxCodeLen, cfreqs, scratch.tree, scratch.codes);
+    rebuildHuffTree(scratch.codes, scratch.tree);
+    buildDecodeTable(scratch.tree, scratch.table);
+    int longest = 0;
+    for (size_t i = 0; i < scratch.codes.size(); i++)
+        longest = max(longest, scratch.codes[i].len);
+    return longest;
+}
+
+/* this function will decode count characters of a context block, split round
+ * robin into streams that start at pos, each with the table of the character
+ * before it; the characters depend on one another through their contexts, so
+ * they are decoded in order, taking one from each stream in turn */
+inline bool decodeContexts(const unsigned char * contents, size_t pos, vector <size_t> &sizes,
+                           decodescratch &scratch, int longest, char * out, size_t count)
+{
+    int nstreams = sizes.size();
+    bitreader br[MAX_STREAMS];
+    for (int s = 0; s < nstreams; s++)
+    {
+        initReader(br[s], sizes[s] ? contents + pos : NULL, sizes[s]);
+        pos += sizes[s];
+    }
+    // the decoding table for each context, looked up directly by the character before
+    const decodeEntry * byContext[256];
+    for (int p = 0; p < 256; p++)
+        byContext[p] = &scratch.contextTables[scratch.contextTable[p]][0];
+
+    /* a refill leaves at least 56 bits, which is enough for this many codes of
+     * the longest length from each stream */
+    size_t batch = 56 / max(longest, 1) * nstreams;
+    unsigned char prev = 0;
+    size_t i = 0;
+    while (i < count)
+    {
+        for (int s = 0; s < nstreams; s++)
+            refill(br[s]);
+        size_t end = min(count, i + batch);
+        for (; i < end; i++)
+        {
+            prev = decodeSymbol(br[i & (nstreams - 1)], byContext[prev]);
+            out[i] = prev;
+        }
+    }
+
+    for (int s = 0; s < nstreams; s++)
+        if (bitsRead(br[s]) > (unsigned long long)sizes[s] * 8)
+            return false;
+    return true;
+}
+
+/* this function will decode count characters of an LZ block, whose encoded
+ * text runs from pos to the end of the size bytes of contents, into out: each
+ * symbol is a character, or the length code of a match, followed by the extra
+ * bits of its length and by its distance, and the match is copied from that
+ * far back in what has been decoded. It returns false if a match reaches back
+ * before the block or past its end, or the encoded text ran out first */
+inline bool decodeLz(const unsigned char * contents, size_t size, size_t pos,
+                     decodescratch &scratch, char * out, size_t count)
+{
+    size_t textBytes = size - pos;
+    bitreader br;
+    initReader(br, textBytes ? contents + pos : NULL, textBytes);
+    const decodeEntry * litlen = &scratch.table[0];
+    const decodeEntry * dist = &scratch.distTable[0];
+
+    /* a refill leaves at least 56 bits, enough for a code and the 5 extra bits
+     * of a length, or for a code and the 28 extra bits of a distance */
+    size_t i = 0;
+    while (i < count)
+    {
+        refill(br);
+        uint symbol = decodeCode(br, litlen);
+        if (symbol < 256)
+        {
+            out[i++] = (char)symbol;
+            continue;
+        }
+        int extraBits;
+        size_t len = MIN_MATCH + lzBucketBase(symbol - 256, 2, extraBits);
+        if (extraBits)
+        {
+            len += peekBits(br, extraBits);
+            consumeBits(br, extraBits);
+        }
+        refill(br);
+        size_t back = 1 + lzBucketBase(decodeCode(br, dist), 1, extraBits);
+        if (extraBits)
+        {
+            back += peekBits(br, extraBits);
+            consumeBits(br, extraBits);
+        }
+        if (back > i || len > count - i)
+            return false;
+
+        // a match may overlap what it copies, repeating it, so it is copied in order
+        char * to = out + i;
+        const char * from = to - back;
+        if (back >= len)
+            memcpy(to, from, len);
+        else
+            for (size_t k = 0; k < len; k++)
+                to[k] = from[k];
+        i += len;
+    }
+    return bitsRead(br) <= (unsigned long long)textBytes * 8;
 }
 
 #endif
@@ -0,0 +1,262 @@
+/* stats.hpp
+ * Written by:  Keefer Rourke
+ * License:     GPLv3
+ *
+ * COPYRIGHT    Keefer Rourke 2015
+ *
+ * Description: This header file contains a set of functions required
+ *              for timing each stage of compression and extraction,
+ *              and reporting the time, memory and compression achieved
+ *              when the --stats option is given
+ *
+ * Disclaimer:  This program is free software: you can redistribute it
+ *              and/or modify it under the terms of the GNU General
+ *              Public License as published by the Free Software
+ *              Foundation, either version 3 of the License, or (at
+ *              your option) any later version.
+ *
+ *              This program is distributed in the hope that it will
+ *              be useful, but WITHOUT ANY WARRANTY; without even the
+ *              implied warranty of MERCHANTABILITY or FITNESS FOR A
+ *              PARTICULAR PURPOSE.  See the GNU General Public License
+ *              for more details.
+ *
+ *              You should have received a copy of the GNU General
+ *              Public License along with this program.  If not, see
+ *              <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __STATS_HPP__
+#define __STATS_HPP__
+
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <cmath>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define HAVE_RUSAGE 1
+#endif
+
+using namespace std;
+
+// no more than this many stages are timed
+const int MAX_STAGES = 8;
+
+
+/* structure used to collect the figures for the --stats report; the stages
+ * run on the worker threads are timed into a copy for each block, which is
+ * added to the total as the block is written, so no locking is needed */
+struct huffstats
+{
+    const char * stages[MAX_STAGES]; // name of each stage
+    int    nstages;
+    double wall[MAX_STAGES];         // seconds spent in each stage
+    double cpu[MAX_STAGES];          // CPU seconds of the thread running it
+    unsigned long long bytesIn;
+    unsigned long long bytesOut;
+    unsigned long long blocks;
+    unsigned long long counts[256];  // occurrences of every character
+    double entropyBits;              // order-0 entropy of every block, in bits
+    unsigned long long codeBits;     // bits of encoded text, without headers
+    int    maxCodeLen;               // longest code of any block
+};
+
+/* structure used to remember when the current stage started */
+struct stagetimer
+{
+    double wall;
+    double cpu;
+};
+
+/* function prototypes */
+atomic <unsigned long long> &allocations();
+void   initStats(huffstats &stats, const char * const stages[], int nstages);
+void   mergeStats(huffstats &total, huffstats &block);
+double wallSeconds();
+double cpuSeconds();
+void   startStage(huffstats * stats, stagetimer &timer);
+void   endStage(huffstats * stats, int stage, stagetimer &timer);
+long   peakRSS();
+void   printStats(ostream &out, huffstats &stats, double wall, bool json);
+
+/* this function will return the number of allocations made by the program;
+ * they are only counted by a program that replaces operator new to do so, as
+ * huffpuff does, and it stays 0 otherwise */
+inline atomic <unsigned long long> &allocations()
+{
+    static atomic <unsigned long long> count(0);
+    return count;
+}
+
+/* this function will clear every figure, and name the stages to be timed */
+inline void initStats(huffstats &stats, const char * const stages[], int nstages)
+{
+    stats.nstages = nstages;
+    for (int i = 0; i < MAX_STAGES; i++)
+    {
+        stats.stages[i] = i < nstages ? stages[i] : "";
+        stats.wall[i] = 0;
+        stats.cpu[i] = 0;
+    }
+    stats.bytesIn = 0;
+    stats.bytesOut = 0;
+    stats.blocks = 0;
+    for (int c = 0; c < 256; c++)
+        stats.counts[c] = 0;
+    stats.entropyBits = 0;
+    stats.codeBits = 0;
+    stats.maxCodeLen = 0;
+}
+
+/* this function will add the figures for one block to the total */
+inline void mergeStats(huffstats &total, huffstats &block)
+{
+    for (int i = 0; i < total.nstages; i++)
+    {
+        total.wall[i] += block.wall[i];
+        total.cpu[i] += block.cpu[i];
+    }
+    total.bytesIn += block.bytesIn;
+    total.bytesOut += block.bytesOut;
+    total.blocks += block.blocks;
+    for (int c = 0; c < 256; c++)
+        total.counts[c] += block.counts[c];
+    total.entropyBits += block.entropyBits;
+    total.codeBits += block.codeBits;
+    total.maxCodeLen = max(total.maxCodeLen, block.maxCodeLen);
+}
+
+/* this function will return the wall clock time in seconds */
+inline double wallSeconds()
+{
+    return chrono::duration <double> (chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* this function will return the CPU time used by the calling thread in
+ * seconds, or by the whole process where threads cannot be told apart */
+inline double cpuSeconds()
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* this function will note the start of a stage; nothing is timed when no
+ * stats are being collected */
+inline void startStage(huffstats * stats, stagetimer &timer)
+{
+    if (stats == NULL)
+        return;
+    timer.wall = wallSeconds();
+    timer.cpu = cpuSeconds();
+}
+
+/* this function will add the time since the timer was started to the given
+ * stage, and start the timer again for the next stage */
+inline void endStage(huffstats * stats, int stage, stagetimer &timer)
+{
+    if (stats == NULL)
+        return;
+    double wall = wallSeconds();
+    double cpu = cpuSeconds();
+    stats -> wall[stage] += wall - timer.wall;
+    stats -> cpu[stage] += cpu - timer.cpu;
+    timer.wall = wall;
+    timer.cpu = cpu;
+}
+
+/* this function will return the most memory the process has had resident
+ * at once in kilobytes, or 0 if it cannot be found */
+inline long peakRSS()
+{
+#ifdef HAVE_RUSAGE
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+/* this function will print the report, as text or as a JSON object; the
+ * figures about codes are only given when there were characters to code,
+ * which is to say when compressing */
+inline void printStats(ostream &out, huffstats &stats, double wall, bool json)
+{
+    unsigned long long characters = 0;
+    int symbols = 0;
+    for (int c = 0; c < 256; c++)
+    {
+        characters += stats.counts[c];
+        symbols += stats.counts[c] > 0;
+    }
+    double entropy = characters ? stats.entropyBits / characters : 0;
+    double avgCodeLen = characters ? (double)stats.codeBits / characters : 0;
+    double achieved = characters ? 8.0 * stats.bytesOut / characters : 0;
+    double cpuTotal = 0;
+    for (int i = 0; i < stats.nstages; i++)
+        cpuTotal += stats.cpu[i];
+
+    ios::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    out << fixed;
+    if (json)
+    {
+        out << "{\"wall_seconds\": " << setprecision(6) << wall
+            << ", \"cpu_seconds\": " << cpuTotal << "," << endl;
+        out << " \"stages\": {";
+        for (int i = 0; i < stats.nstages; i++)
+            out << (i ? "," : "") << endl << "   \"" << stats.stages[i]
+                << "\": {\"wall_seconds\": " << stats.wall[i]
+                << ", \"cpu_seconds\": " << stats.cpu[i] << "}";
+        out << "}," << endl;
+        out << " \"bytes_in\": " << stats.bytesIn << ", \"bytes_out\": " << stats.bytesOut
+            << ", \"blocks\": " << stats.blocks << "," << endl;
+        if (characters)
+            out << " \"symbols\": " << symbols << ", \"max_code_len\": " << stats.maxCodeLen
+                << ", \"avg_code_len\": " << setprecision(4) << avgCodeLen
+                << ", \"entropy_bits_per_symbol\": " << entropy
+                << ", \"achieved_bits_per_symbol\": " << achieved << "," << endl;
+        out << " \"peak_rss_kb\": " << peakRSS()
+            << ", \"allocations\": " << allocations().load() << "}" << endl;
+    }
+    else
+    {
+        out << "stage                wall (s)     cpu (s)" << endl;
+        for (int i = 0; i < stats.nstages; i++)
+            out << "  " << left << setw(16) << stats.stages[i] << right << setprecision(6)
+                << setw(12) << stats.wall[i] << setw(12) << stats.cpu[i] << endl;
+        out << "  " << left << setw(16) << "total" << right << setw(12) << wall
+            << setw(12) << cpuTotal << endl;
+        out << "bytes in             " << stats.bytesIn << endl;
+        out << "bytes out            " << stats.bytesOut << endl;
+        out << "blocks               " << stats.blocks << endl;
+        if (characters)
+        {
+            out << "symbols              " << symbols << endl;
+            out << "max code length      " << stats.maxCodeLen << " bits" << endl;
+            out << "avg code length      " << setprecision(4) << avgCodeLen << " bits" << endl;
+            out << "entropy              " << entropy << " bits/symbol" << endl;
+            out << "achieved             " << achieved << " bits/symbol" << endl;
+        }
+        out << "peak RSS             " << peakRSS() << " KB" << endl;
+        out << "allocations          " << allocations().load() << endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+#endif
@@ -0,0 +1,115 @@
+/* threadpool.hpp
+ * Written by:  Keefer Rourke
+ * License:     GPLv3
+ *
+ * COPYRIGHT    Keefer Rourke 2015
+ *
+ * Description: This header file contains a set of functions required
+ *              for running tasks, such as compressing a block, on a
+ *              fixed set of worker threads
+ *
+ * Disclaimer:  This program is free software: you can redistribute it
+ *              and/or modify it under the terms of the GNU General
+ *              Public License as published by the Free Software
+ *              Foundation, either version 3 of the License, or (at
+ *              your option) any later version.
+ *
+ *              This program is distributed in the hope that it will
+ *              be useful, but WITHOUT ANY WARRANTY; without even the
+ *              implied warranty of MERCHANTABILITY or FITNESS FOR A
+ *              PARTICULAR PURPOSE.  See the GNU General Public License
+ *              for more details.
+ *
+ *              You should have received a copy of the GNU General
+ *              Public License along with this program.  If not, see
+ *              <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __THREADPOOL_HPP__
+#define __THREADPOOL_HPP__
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+
+using namespace std;
+
+/* structure used to hold the worker threads and the tasks waiting for them */
+struct threadpool
+{
+    vector <thread> workers;
+    deque < function <void()> > tasks;
+    mutex lock;
+    condition_variable wake;
+    bool stopping;
+};
+
+/* function prototypes */
+void startPool(threadpool &pool, int nthreads);
+future <void> submitTask(threadpool &pool, function <void()> task);
+void runTasks(threadpool * pool);
+void stopPool(threadpool &pool);
+
+/* this function will start nthreads workers waiting for tasks */
+inline void startPool(threadpool &pool, int nthreads)
+{
+    pool.stopping = false;
+    for (int i = 0; i < nthreads; i++)
+        pool.workers.push_back(thread(runTasks, &pool));
+}
+
+/* this function will queue a task for the next free worker, returning a
+ * future that is ready once the task has run */
+inline future <void> submitTask(threadpool &pool, function <void()> task)
+{
+    shared_ptr < packaged_task <void()> > job(new packaged_task <void()> (task));
+    future <void> done = job -> get_future();
+    {
+        lock_guard <mutex> guard(pool.lock);
+        pool.tasks.push_back([job]() { (*job)(); });
+    }
+    pool.wake.notify_one();
+    return done;
+}
+
+/* this function is run by each worker, taking tasks from the queue until the
+ * pool is stopped and the queue is empty */
+inline void runTasks(threadpool * pool)
+{
+    while (true)
+    {
+        function <void()> task;
+        {
+            unique_lock <mutex> guard(pool -> lock);
+            while (!pool -> stopping && pool -> tasks.empty())
+                pool -> wake.wait(guard);
+            if (pool -> tasks.empty())
+                return;
+            task = pool -> tasks.front();
+            pool -> tasks.pop_front();
+        }
+        task();
+    }
+}
+
+/* this function will let the workers finish the tasks already queued, and
+ * then wait for them to exit */
+inline void stopPool(threadpool &pool)
+{
+    {
+        lock_guard <mutex> guard(pool.lock);
+        pool.stopping = true;
+    }
+    pool.wake.notify_all();
+    for (size_t i = 0; i < pool.workers.size(); i++)
+        pool.workers[i].join();
+    pool.workers.clear();
+}
+
+#endif
@@ -0,0 +1,252 @@
+# roundtrip.sh
+# Written by:  Keefer Rourke
+# License:     GPLv3
+#
+# Compresses and extracts inputs that have tripped the decoder up before, with
+# each set of options, and checks that they come back unchanged. Run it from
+# the top of the tree with `make check`; HUFFPUFF names the program to test.
+
+HUFFPUFF=${HUFFPUFF:-./huffpuff}
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+passed=0
+failed=0
+
+# check that a test passed, naming it if it did not
+result()
+{
+    if [ "$1" -eq 0 ]; then
+        passed=$((passed + 1))
+    else
+        failed=$((failed + 1))
+        echo "FAIL: $2"
+    fi
+}
+
+# roundtrip FILE OPTIONS...: compress FILE with the options and extract it
+roundtrip()
+{
+    file=$1
+    shift
+    rm -f "$tmp/out.bin" "$tmp/out.txt"
+    "$HUFFPUFF" -c "$@" "$file" "$tmp/out.bin" >/dev/null 2>&1
+    "$HUFFPUFF" -x "$tmp/out.bin" "$tmp/out.txt" >/dev/null 2>&1
+    cmp -s "$file" "$tmp/out.txt"
+    result $? "$(basename "$file") $*"
+}
+
+# pipe FILE OPTIONS...: compress FILE from standard input to standard output
+# with the options, and extract it the same way
+pipe()
+{
+    file=$1
+    shift
+    rm -f "$tmp/out.bin" "$tmp/out.txt"
+    "$HUFFPUFF" -c "$@" - - < "$file" > "$tmp/out.bin" 2>/dev/null
+    "$HUFFPUFF" -x - - < "$tmp/out.bin" > "$tmp/out.txt" 2>/dev/null
+    cmp -s "$file" "$tmp/out.txt"
+    result $? "$(basename "$file") through a pipe $*"
+}
+
+# extractrange FILE START LENGTH OPTIONS...: compress FILE with the options and
+# extract LENGTH characters from START on
+extractrange()
+{
+    file=$1
+    start=$2
+    length=$3
+    shift 3
+    rm -f "$tmp/out.bin" "$tmp/out.txt"
+    "$HUFFPUFF" -c "$@" "$file" "$tmp/out.bin" >/dev/null 2>&1
+    "$HUFFPUFF" -x --range "$start:$length" "$tmp/out.bin" "$tmp/out.txt" >/dev/null 2>&1
+    tail -c +$((start + 1)) "$file" | head -c "$length" > "$tmp/expected.txt"
+    cmp -s "$tmp/expected.txt" "$tmp/out.txt"
+    result $? "$(basename "$file") --range $start:$length $*"
+}
+
+# eight equally common characters get 3 bit codes, a period of three gives 1
+# and 2 bit codes, and two characters need only a single bit each; in pairs,
+# each character is followed by one of just two others
+awk 'BEGIN { for (i = 0; i < 25600; i++) printf "abcdefgh" }' > "$tmp/uniform8"
+awk 'BEGIN { for (i = 0; i < 70000; i++) printf "baa" }' > "$tmp/periodic"
+awk 'BEGIN { srand(1); for (i = 0; i < 200000; i++) printf (rand() < 0.5 ? "x" : "y") }' \
+    > "$tmp/two"
+awk 'BEGIN { split("xy xz pq pr", p); srand(3)
+    for (i = 0; i < 100000; i++) printf "%s", p[int(rand() * 4) + 1] }' > "$tmp/pairs"
+head -c 200000 /dev/zero > "$tmp/single"
+head -c 300000 /dev/urandom > "$tmp/random"
+cat lib/*.hpp huffpuff.cpp README.md > "$tmp/text"
+cat "$tmp/text" "$tmp/random" "$tmp/text" > "$tmp/mixed"
+inputs="$tmp/uniform8 $tmp/periodic $tmp/two $tmp/pairs $tmp/single $tmp/random $tmp/text"
+
+for file in $inputs; do
+    roundtrip "$file"
+    for streams in 1 2 4 8; do
+        roundtrip "$file" --streams $streams
+        roundtrip "$file" --streams $streams -b 10K -j 4
+    done
+    roundtrip "$file" --max-code-len 8
+    roundtrip "$file" --max-code-len 15
+    pipe "$file"
+    pipe "$file" -b 10K -j 4
+done
+
+# adaptive coding, with codes changed after every character or rebuilt every
+# so often, from a file and through a pipe
+for file in $inputs; do
+    roundtrip "$file" -a
+    roundtrip "$file" --rebuild 1K
+    roundtrip "$file" --rebuild 64K
+    pipe "$file" -a
+    pipe "$file" --rebuild 4K
+done
+
+# dictionaries trained on small messages like the ones compressed with them;
+# a message must not be extracted with a dictionary other than its own
+mkdir "$tmp/samples" "$tmp/other"
+awk -v dir="$tmp" 'BEGIN {
+    srand(2)
+    for (i = 0; i < 40; i++) {
+        f = dir "/samples/" i ".json"
+        printf "{\"id\": %d, \"user\": \"u%d\", \"event\": \"%s\", \"ms\": %d}\n", \
+            i, int(rand() * 1000), (rand() < 0.7 ? "click" : "view"), int(rand() * 500) > f
+        close(f)
+        f = dir "/other/" i ".txt"
+        printf "line %d of some other kind of text, %d\n", i, int(rand() * 100000) > f
+        close(f)
+    }
+}'
+"$HUFFPUFF" --train "$tmp/json.dict" "$tmp"/samples/*.json >/dev/null 2>&1
+"$HUFFPUFF" --train "$tmp/other.dict" "$tmp"/other/*.txt >/dev/null 2>&1
+for message in "$tmp/samples/3.json" "$tmp/samples/17.json" "$tmp/other/5.txt"; do
+    rm -f "$tmp/out.bin" "$tmp/out.txt"
+    "$HUFFPUFF" -c --dict "$tmp/json.dict" "$message" "$tmp/out.bin" >/dev/null 2>&1
+    "$HUFFPUFF" -x --dict "$tmp/json.dict" "$tmp/out.bin" "$tmp/out.txt" >/dev/null 2>&1
+    cmp -s "$message" "$tmp/out.txt"
+    result $? "$(basename "$message") --dict"
+done
+rm -f "$tmp/out.txt"
+"$HUFFPUFF" -x --dict "$tmp/other.dict" "$tmp/out.bin" "$tmp/out.txt" 2> "$tmp/errors" >/dev/null
+grep -q "was compressed with dictionary" "$tmp/errors" && [ ! -e "$tmp/out.txt" ]
+result $? "extracting with the wrong dictionary is refused"
+
+# context tables chosen by the previous character
+for file in $inputs; do
+    roundtrip "$file" --context
+    roundtrip "$file" --context --streams 4
+    roundtrip "$file" --context --streams 8 -b 10K -j 4
+done
+
+# LZ77 matches in front of the Huffman coder, at the quickest and the
+# thoroughest levels, and with a small window
+for file in $inputs; do
+    roundtrip "$file" --lz 1
+    roundtrip "$file" --lz 6 --streams 4 -b 10K -j 4
+    roundtrip "$file" --lz 9 --window 4K
+done
+
+# random bytes are stored as they are and a single repeated byte is run
+# length coded, each costing no more than 32 bytes a block; the number of
+# blocks comes first in each set of options
+for opts in "1" "30 -b 10K -j 4" "1 --streams 4" "1 --context" "1 --lz 6"; do
+    set -- $opts
+    blocks=$1
+    shift
+    roundtrip "$tmp/random" "$@"
+    size=$(wc -c < "$tmp/out.bin")
+    [ "$size" -le $((300000 + 32 * blocks + 32)) ]
+    result $? "random${*:+ $*} is stored, in $size bytes"
+    roundtrip "$tmp/single" "$@"
+    size=$(wc -c < "$tmp/out.bin")
+    [ "$size" -le $((32 * blocks + 32)) ]
+    result $? "single${*:+ $*} is run length coded, in $size bytes"
+done
+
+# small blocks of the same text repeat the table of the block before them,
+# which must come out the same however many threads compress them
+for file in $inputs; do
+    roundtrip "$file" -b 16K
+    roundtrip "$file" -b 4K --streams 4 -j 4
+done
+"$HUFFPUFF" -c -b 4K -j 1 "$tmp/text" "$tmp/one.bin" >/dev/null 2>&1
+"$HUFFPUFF" -c -b 4K -j 4 "$tmp/text" "$tmp/four.bin" >/dev/null 2>&1
+cmp -s "$tmp/one.bin" "$tmp/four.bin"
+result $? "text -b 4K is the same with -j 1 and -j 4"
+
+# blocks split where the statistics change, such as around the random bytes
+# in the middle of mixed
+for file in $inputs "$tmp/mixed"; do
+    roundtrip "$file" --split
+    roundtrip "$file" --split -b 64K -j 4
+done
+roundtrip "$tmp/mixed" --split --context --streams 4
+
+# every level, and a level with options that override it; at -1 the codes
+# come from a sample, which the blocks of trick show nothing like the rest of
+i=0
+while [ $i -lt 64 ]; do
+    tail -c +$((i * 1024 + 1)) "$tmp/text" | head -c 1024
+    head -c 7168 /dev/urandom
+    i=$((i + 1))
+done > "$tmp/trick"
+for file in $inputs "$tmp/mixed" "$tmp/trick"; do
+    for level in 1 2 3 4 5 6 7 8 9; do
+        roundtrip "$file" -$level
+    done
+    roundtrip "$file" -1 -b 64K -j 4
+    roundtrip "$file" -9 --max-code-len 11 --streams 1
+done
+for file in "$tmp/text" "$tmp/mixed" "$tmp/trick"; do
+    "$HUFFPUFF" -c -1 -b 16K -j 1 "$file" "$tmp/one.bin" >/dev/null 2>&1
+    "$HUFFPUFF" -c -1 -b 16K -j 4 "$file" "$tmp/four.bin" >/dev/null 2>&1
+    cmp -s "$tmp/one.bin" "$tmp/four.bin"
+    result $? "$(basename "$file") -1 -b 16K is the same with -j 1 and -j 4"
+done
+
+# batches: --batch compresses each file named to one with .bin added, as does
+# --from-list for the files listed; without --batch two names are the input
+# and the output, and three are refused
+mkdir "$tmp/batch"
+for file in $inputs; do
+    cp "$file" "$tmp/batch/"
+done
+for threads in 1 2; do
+    rm -f "$tmp"/batch/*.bin
+    "$HUFFPUFF" -c --batch -j $threads "$tmp"/batch/* >/dev/null 2>&1
+    for file in "$tmp"/batch/*; do
+        case $file in *.bin) continue ;; esac
+        rm -f "$tmp/out.txt"
+        "$HUFFPUFF" -x "$file.bin" "$tmp/out.txt" >/dev/null 2>&1
+        cmp -s "$file" "$tmp/out.txt"
+        result $? "$(basename "$file") --batch -j $threads"
+    done
+done
+rm -f "$tmp"/batch/*.bin
+ls "$tmp"/batch/* | "$HUFFPUFF" -c -j 2 --from-list - >/dev/null 2>&1
+for file in "$tmp"/batch/*; do
+    case $file in *.bin) continue ;; esac
+    rm -f "$tmp/out.txt"
+    "$HUFFPUFF" -x "$file.bin" "$tmp/out.txt" >/dev/null 2>&1
+    cmp -s "$file" "$tmp/out.txt"
+    result $? "$(basename "$file") --from-list"
+done
+rm -f "$tmp"/batch/*.bin "$tmp/out.txt"
+"$HUFFPUFF" -c "$tmp/batch/text" "$tmp/batch/two" >/dev/null 2>&1
+"$HUFFPUFF" -x "$tmp/batch/two" "$tmp/out.txt" >/dev/null 2>&1
+cmp -s "$tmp/text" "$tmp/out.txt" && [ ! -e "$tmp/batch/text.bin" ]
+result $? "two names without --batch are the input and the output"
+cp "$tmp/two" "$tmp/batch/two"
+"$HUFFPUFF" -c "$tmp/batch/text" "$tmp/batch/two" "$tmp/batch/single" >/dev/null 2>&1
+cmp -s "$tmp/two" "$tmp/batch/two" && [ ! -e "$tmp/batch/text.bin" ]
+result $? "three names without --batch are refused"
+
+for start in 0 5000 60000; do
+    extractrange "$tmp/text" $start 20000 -b 4K
+    extractrange "$tmp/text" $start 20000 -b 4K --streams 4 -j 4
+    extractrange "$tmp/text" $start 20000 -b 1K
+    extractrange "$tmp/mixed" $((start * 4)) 200000 --split -b 64K -j 4
+done
+
+echo "$passed round trips passed, $failed failed"
+[ "$failed" -eq 0 ]